@@ -1,6 +1,6 @@
 #include "h/Engine/InputManager.h"
 
-static const GLuint ENGINE_KEYS[7] = { GLFW_KEY_F, GLFW_KEY_I, GLFW_KEY_UP, GLFW_KEY_DOWN, GLFW_KEY_ESCAPE, GLFW_KEY_P, GLFW_KEY_B };
+static const GLuint ENGINE_KEYS[14] = { GLFW_KEY_F, GLFW_KEY_I, GLFW_KEY_UP, GLFW_KEY_DOWN, GLFW_KEY_ESCAPE, GLFW_KEY_P, GLFW_KEY_B, GLFW_KEY_C, GLFW_KEY_V, GLFW_KEY_O, GLFW_KEY_K, GLFW_KEY_T, GLFW_KEY_N, GLFW_KEY_M };
 static const GLuint PLAYER_KEYS[7] = { GLFW_KEY_W, GLFW_KEY_A, GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_SPACE, GLFW_KEY_LEFT_SHIFT, GLFW_KEY_G };
 
 InputManager::InputManager() 
@@ -39,6 +39,13 @@ InputEvents InputManager::poll(bool uiCursorActive) {
 	ev.toggleDebug = pressed(GLFW_KEY_I) && !uiCursorActive;
 	ev.toggleEntityBoxes = pressed(GLFW_KEY_B) && !uiCursorActive;
 	ev.toggleGravity = pressed(GLFW_KEY_G) && !uiCursorActive;
+	ev.toggleGpuCulling = pressed(GLFW_KEY_C) && !uiCursorActive;
+	ev.toggleCullVerification = pressed(GLFW_KEY_V) && !uiCursorActive;
+	ev.toggleOcclusionCulling = pressed(GLFW_KEY_O) && !uiCursorActive;
+	ev.toggleConnectivityCulling = pressed(GLFW_KEY_K) && !uiCursorActive;
+	ev.runDirectoryStress = pressed(GLFW_KEY_T) && !uiCursorActive;
+	ev.runProcGenBenchmark = pressed(GLFW_KEY_N) && !uiCursorActive;
+	ev.runOcclusionBenchmark = pressed(GLFW_KEY_M) && !uiCursorActive;
 	if (pressed(GLFW_KEY_UP) && !uiCursorActive) ev.renderRadiusDelta = +1;
 	if (pressed(GLFW_KEY_DOWN) && !uiCursorActive) ev.renderRadiusDelta = -1;
 
@@ -5,6 +5,8 @@
 #include <string>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
+#include <thread>
 
 VoxelEngine::VoxelEngine() 
     : fps(std::numeric_limits<int>::min())
@@ -16,7 +18,10 @@ VoxelEngine::VoxelEngine()
     , usePostProcessing(true)
     , drawEntityBoxes(false)
     , renderRadius(48)
-    , vertexPool(1ULL * 1024 * 1024 * 1024) 
+    , vertexPool(1ULL * 1024 * 1024 * 1024)    // budget, the pool only grows this far when the render radius needs it
+    , lastDirectoryStress{}
+    , lastProcGenBenchmark{}
+    , lastOcclusionBenchmark{}
 {
 	currChunkX = ChunkUtils::worldToChunkCoord(static_cast<int>(floor(camera.getCameraPos().x)));
 	currChunkZ = ChunkUtils::worldToChunkCoord(static_cast<int>(floor(camera.getCameraPos().z)));
@@ -157,6 +162,20 @@ void VoxelEngine::processInput() {
 		if (ev.togglePostFX) usePostProcessing = !usePostProcessing;            // P
         if (ev.toggleDebug) renderDebug = !renderDebug;                         // I
         if (ev.toggleEntityBoxes) drawEntityBoxes = !drawEntityBoxes;           // B
+        if (ev.toggleGpuCulling) worldManager.toggleGpuCulling();               // C
+        if (ev.toggleCullVerification) worldManager.toggleCullVerification();   // V
+        if (ev.toggleOcclusionCulling) worldManager.toggleOcclusionCulling();   // O
+        if (ev.toggleConnectivityCulling) worldManager.toggleConnectivityCulling();   // K
+        if (ev.runDirectoryStress && !directoryStress.valid()) {                // T
+            directoryStress = std::async(std::launch::async, ChunkDirectory::stressTest, 4, 2.0);   // 4 readers for 2 s
+        }
+        if (ev.runProcGenBenchmark && !procGenBenchmark.valid()) {              // N
+            int threads = std::max(1, (int)std::thread::hardware_concurrency());
+            procGenBenchmark = std::async(std::launch::async, &ProcGen::benchmark, &proceduralGenerator, threads, 16);   // 16x16 chunks per run
+        }
+        if (ev.runOcclusionBenchmark && !occlusionBenchmark.valid()) {          // M
+            occlusionBenchmark = std::async(std::launch::async, SoftwareOcclusionCuller::benchmark, std::cref(proceduralGenerator), 32);   // 65x65 chunks
+        }
 
         if (ev.renderRadiusDelta != 0) {                                        // Up/down arrow
             int newRadius = renderRadius + ev.renderRadiusDelta;
@@ -204,6 +223,9 @@ void VoxelEngine::render() {
     proceduralGenerationGui.startLoop();
 
     GLCall(glEnable(GL_DEPTH_TEST));
+    // The default framebuffer's depth can't be sampled, so occlusion culling needs the post-processing target
+    if (usePostProcessing) worldManager.setOcclusionDepth(postFX.depthTexture(), postFX.width(), postFX.height());
+    else worldManager.setOcclusionDepth(0, 0, 0);
     worldManager.render();
 
     if (drawEntityBoxes) entityAABBRenderer.draw((glm::mat4&)camera.getView(), (glm::mat4&)camera.getProjection(), 1.8f);
@@ -225,6 +247,124 @@ void VoxelEngine::render() {
         stream << fps * (1.f / fpsUpdateTime) << "\n";
         stream << cameraPos.x << " " << (cameraPos.y - 1.65) << " " << cameraPos.z << "\n";
 
+        const double mib = 1024.0 * 1024.0;
+        VertexPoolStats poolStats = vertexPool.getStats();
+        stream << "Pool HWM: " << poolStats.vertexHighWater / mib << "/" << poolStats.vertexRegionBytes / mib << " MiB verts, "
+            << poolStats.indexHighWater / mib << "/" << poolStats.indexRegionBytes / mib << " MiB inds\n";
+        stream << "Compacted: " << poolStats.compactedBytes / 1024.0 << " KiB/frame\n";
+        stream << "Remesh/min: " << poolStats.inPlacePerMinute << " in place, " << poolStats.relocationsPerMinute << " relocated, "
+            << poolStats.lodSwapsPerMinute << " LOD swaps\n";
+        stream << "Pool budget: " << (poolStats.vertexRegionBytes + poolStats.indexRegionBytes) / mib << "/" << poolStats.budgetBytes / mib
+            << " MiB, evicted " << poolStats.evictionsPerMinute << "/min\n";
+        stream << "LOD MiB:";
+        for (int lod = 0; lod < ChunkUtils::LOD_COUNT; ++lod) stream << " " << lod << ":" << poolStats.lodBytes[lod] / mib;
+        stream << "\n";
+        const LodSelector& lodSelector = worldManager.getLodSelector();
+        stream << "LOD bands at " << lodSelector.maxErrorPixels << " px:";
+        for (size_t lod = 0; lod < lodSelector.radii.size(); ++lod) stream << " " << lodSelector.radii[lod] << "/" << lodSelector.flatRadii[lod];
+        stream << " chunks (rough/flat)\n";
+        stream << "Draw slots: " << poolStats.commandSlots << " (" << poolStats.commandUploads << " rewritten)\n";
+        stream << "Uploads: " << poolStats.uploadedBytes / 1024.0 << " KiB/frame (" << poolStats.uploads << " meshes), "
+            << poolStats.waitingUploads << " waiting\n";
+        StreamingStats streamStats = worldManager.getStreamingStats();
+        stream << "Streaming: " << streamStats.queued << " queued of " << streamStats.wanted << " wanted, "
+            << streamStats.cancelledLastFocus << " cancelled, visible in avg " << streamStats.avgTimeToVisibleMs
+            << " ms (max " << streamStats.maxTimeToVisibleMs << " ms)";
+        if (streamStats.fillRing >= 0) stream << ", filling ring " << streamStats.fillRing;
+        stream << "\n";
+        stream << "Pop-in ahead: avg " << streamStats.avgPopInAhead << " chunks (min " << streamStats.minPopInAhead << ")\n";
+        BringUpStats bringUp = worldManager.getBringUpStats();
+        stream << "Bring-up: ";
+        if (bringUp.phase == BringUpPhase::Coarse) stream << "coarse pass, " << bringUp.elapsedSeconds << " s";
+        else {
+            stream << "horizon complete in " << bringUp.horizonSeconds << " s, ";
+            if (bringUp.phase == BringUpPhase::Refining) stream << "refining, " << bringUp.elapsedSeconds << " s";
+            else stream << "full detail in " << bringUp.fullDetailSeconds << " s";
+        }
+        stream << "\n";
+        RetentionStats retentionStats = worldManager.getRetentionStats();
+        stream << "Retained: " << retentionStats.chunks << " chunks in " << retentionStats.voxelBytes / mib << "/" << retentionStats.voxelBudget / mib
+            << " MiB, " << retentionStats.meshes << " meshes in " << retentionStats.meshBytes / mib << "/" << retentionStats.meshBudget / mib
+            << " MiB, hit rate " << retentionStats.hitRate * 100.0 << "% (" << retentionStats.meshHits << " of " << retentionStats.hits
+            << " hits skipped meshing)\n";
+        ChunkDirectoryStats directoryStats = worldManager.getDirectoryStats();
+        stream << "Directory: " << directoryStats.chunks << "/" << directoryStats.capacity << " slots, epoch " << directoryStats.epoch;
+        ChunkReclaimerStats reclaimerStats = worldManager.getReclaimerStats();
+        stream << ", " << reclaimerStats.reclaimed << " freed off-thread (" << reclaimerStats.queued << " queued, max batch "
+            << reclaimerStats.maxBatchMs << " ms)";
+        if (directoryStress.valid() && directoryStress.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            lastDirectoryStress = directoryStress.get();
+        }
+        if (directoryStress.valid()) stream << ", stress test running";
+        else if (lastDirectoryStress.readers > 0) {
+            stream << ", stress " << lastDirectoryStress.lookupsPerSecond / 1e6 << " M lookups/s over " << lastDirectoryStress.readers
+                << " readers, " << lastDirectoryStress.errors << " errors";
+        }
+        stream << "\n";
+        HeightMapCacheStats tileStats = proceduralGenerator.getHeightMapCacheStats();
+        stream << "Height tiles: " << tileStats.tiles << " in " << tileStats.bytes / mib << "/" << tileStats.budgetBytes / mib
+            << " MiB, hit rate " << tileStats.hitRate * 100.0 << "% (" << tileStats.hits << " hits, " << tileStats.misses << " evaluated)\n";
+        if (procGenBenchmark.valid() && procGenBenchmark.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            lastProcGenBenchmark = procGenBenchmark.get();
+        }
+        if (procGenBenchmark.valid()) stream << "ProcGen: benchmark running\n";
+        else if (!lastProcGenBenchmark.runs.empty()) {
+            stream << "ProcGen: " << lastProcGenBenchmark.chunks << " chunks,";
+            double single = lastProcGenBenchmark.runs.front().chunksPerSecond;
+            for (const ProcGenBenchmarkRun& run : lastProcGenBenchmark.runs) {
+                stream << " " << run.threads << "t " << run.chunksPerSecond << "/s";
+                if (single > 0.0 && run.threads > 1) stream << " (x" << run.chunksPerSecond / single << ")";
+            }
+            stream << ", " << lastProcGenBenchmark.mismatches << " mismatches\n";
+            stream << "Noise: " << lastProcGenBenchmark.noiseInstructionSet << " " << lastProcGenBenchmark.kernelNsPerSample << " ns/sample vs "
+                << lastProcGenBenchmark.scalarNsPerSample << " scalar, max error " << lastProcGenBenchmark.noiseMaxError << "\n";
+            stream << "Gen us/chunk:";
+            for (int lod = 0; lod < ChunkUtils::LOD_COUNT; ++lod) {
+                stream << " " << lod << ":" << lastProcGenBenchmark.lodMicrosPerChunk[lod];
+                if (lod >= ProcGen::PREFILTER_FROM_LOD) stream << " (~" << lastProcGenBenchmark.lodHeightError[lod] << ")";
+            }
+            stream << " (~mean blocks off a full average)\n";
+            stream << "Column writer: " << lastProcGenBenchmark.spanNsPerVoxel << " ns/voxel vs " << lastProcGenBenchmark.loopNsPerVoxel
+                << " per voxel loop, " << lastProcGenBenchmark.writerMismatches << " mismatches\n";
+        }
+        if (worldManager.usesConnectivityCulling()) {
+            VisibilityGraphStats graphStats = worldManager.getVisibilityGraphStats();
+            stream << "Connectivity: " << graphStats.reachable << "/" << graphStats.candidates << " chunks reachable, "
+                << graphStats.sectionsVisited << " sections walked\n";
+        }
+        if (worldManager.usesGpuCulling()) {
+            ChunkCullStats cullStats = worldManager.getCullStats();
+            stream << "GPU cull: " << cullStats.drawn << " drawn, " << cullStats.inFrustum << "/" << cullStats.candidates << " in frustum";
+            if (cullStats.verified) stream << ", " << cullStats.mismatches << " mismatches vs CPU";
+            stream << "\n";
+            if (cullStats.occlusion) {
+                stream << "Occluded: " << cullStats.occluded << " chunks, " << cullStats.trianglesSaved / 1000.0 << "k tris saved\n";
+            }
+        }
+        else {
+            ChunkQuadtreeStats treeStats = worldManager.getQuadtreeStats();
+            stream << "CPU cull: " << treeStats.visible << " visible, " << treeStats.nodesTested << " nodes, "
+                << treeStats.leafBatches << " SIMD batches, " << treeStats.acceptedWhole << " accepted whole, "
+                << worldManager.getSkippedCullUpdates() << " updates skipped\n";
+            if (worldManager.usesSoftwareOcclusion()) {
+                SoftwareCullStats occlusionStats = worldManager.getSoftwareCullStats();
+                stream << "CPU occlusion: " << occlusionStats.occluded << "/" << occlusionStats.tested << " occluded ("
+                    << occlusionStats.occluderQuads << " occluder quads, "
+                    << occlusionStats.rasterMs + occlusionStats.testMs << " ms)\n";
+            }
+        }
+        if (occlusionBenchmark.valid() && occlusionBenchmark.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            lastOcclusionBenchmark = occlusionBenchmark.get();
+        }
+        if (occlusionBenchmark.valid()) stream << "Occlusion benchmark: running\n";
+        else if (!lastOcclusionBenchmark.poses.empty()) {
+            stream << "Occlusion benchmark: " << lastOcclusionBenchmark.chunks << " chunks in " << lastOcclusionBenchmark.generateSeconds << " s,";
+            for (const SoftwareCullBenchmarkPose& pose : lastOcclusionBenchmark.poses) {
+                stream << " " << pose.name << " " << pose.occluded << "/" << pose.tested << " (" << pose.rasterMs << "+" << pose.testMs << " ms)";
+            }
+            stream << "\n";
+        }
+
         debugUI.renderText(debugShader, stream.str(), 10.0f, 1020.0f, 0.8f, glm::vec3(0.f, 0.f, 0.f));
     }
 
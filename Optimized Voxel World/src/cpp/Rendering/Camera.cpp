@@ -19,7 +19,11 @@ Camera::Camera(float inputSensitivity)
 
 void Camera::update()
 {
-	view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+	glm::mat4 newView = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+	if (newView != view) {
+		view = newView;
+		++transformVersion;
+	}
 }
 
 void Camera::processMouseMovement(double xPos, double yPos)
@@ -50,27 +54,12 @@ void Camera::updateCameraVectors() {
 	cameraFront = glm::normalize(front);
 }
 
-std::vector<std::pair<int, int>> Camera::getVisibleChunks(int renderDistance) {
-	std::vector<std::pair<int, int>> visibleChunks;
-	auto planes = calculateFrustumPlanes();
-
-	int centerX = ChunkUtils::worldToChunkCoord(static_cast<int>(floor(cameraPos.x)));
-	int centerZ = ChunkUtils::worldToChunkCoord(static_cast<int>(floor(cameraPos.z)));
-
-	for (int x = centerX - renderDistance; x <= centerX + renderDistance; ++x) {
-		for (int z = centerZ - renderDistance; z <= centerZ + renderDistance; ++z) {
-			if (isChunkVisible(std::make_pair(x, z), planes)) {
-				visibleChunks.push_back({ x, z });
-			}
-		}
-	}
-
-	return visibleChunks;
+std::array<glm::vec4, 6> Camera::calculateFrustumPlanes() const {
+	return extractFrustumPlanes(projection * view);
 }
 
-std::array<glm::vec4, 6> Camera::calculateFrustumPlanes() const {
+std::array<glm::vec4, 6> Camera::extractFrustumPlanes(const glm::mat4& comb) {
 	std::array<glm::vec4, 6> planes;
-	glm::mat4 comb = projection * view;
 
 	// Extract planes
 	// Right
@@ -94,31 +83,6 @@ std::array<glm::vec4, 6> Camera::calculateFrustumPlanes() const {
 	return planes;
 }
 
-bool Camera::isChunkVisible(const std::pair<int, int>& chunkCoord, const std::array<glm::vec4, 6>& planes) const {
-	glm::vec3 boundingBox[8];
-	boundingBox[0] = glm::vec3(chunkCoord.first * ChunkUtils::WIDTH,						0,						chunkCoord.second * ChunkUtils::DEPTH);
-	boundingBox[1] = glm::vec3(chunkCoord.first * ChunkUtils::WIDTH + ChunkUtils::WIDTH,	0,						chunkCoord.second * ChunkUtils::DEPTH);
-	boundingBox[2] = glm::vec3(chunkCoord.first * ChunkUtils::WIDTH + ChunkUtils::WIDTH,	0,						chunkCoord.second * ChunkUtils::DEPTH + ChunkUtils::DEPTH);
-	boundingBox[3] = glm::vec3(chunkCoord.first * ChunkUtils::WIDTH,						0,						chunkCoord.second * ChunkUtils::DEPTH + ChunkUtils::DEPTH);
-	boundingBox[4] = glm::vec3(chunkCoord.first * ChunkUtils::WIDTH,						ChunkUtils::HEIGHT,		chunkCoord.second * ChunkUtils::DEPTH);
-	boundingBox[5] = glm::vec3(chunkCoord.first * ChunkUtils::WIDTH + ChunkUtils::WIDTH,	ChunkUtils::HEIGHT,		chunkCoord.second * ChunkUtils::DEPTH);
-	boundingBox[6] = glm::vec3(chunkCoord.first * ChunkUtils::WIDTH + ChunkUtils::WIDTH,	ChunkUtils::HEIGHT,		chunkCoord.second * ChunkUtils::DEPTH + ChunkUtils::DEPTH);
-	boundingBox[7] = glm::vec3(chunkCoord.first * ChunkUtils::WIDTH,						ChunkUtils::HEIGHT,		chunkCoord.second * ChunkUtils::DEPTH + ChunkUtils::DEPTH);
-
-	for (const auto& plane : planes) {
-		int outside = 0;
-		for (int i = 0; i < 8; ++i) {
-			if (glm::dot(glm::vec3(plane), boundingBox[i]) + plane.w < 0) {
-				++outside;
-			}
-		}
-		if (outside == 8) return false;
-	}
-
-
-	return true;
-}
-
 void Camera::setCameraPos(glm::vec3 pos) {
 	cameraPos = pos;
 }
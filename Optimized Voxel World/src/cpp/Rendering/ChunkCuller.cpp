@@ -0,0 +1,321 @@
+#include "h/Rendering/ChunkCuller.h"
+#include "h/Rendering/Utility/GLErrorCatcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+ChunkCuller::ChunkCuller()
+    : drawBuf_(0)
+    , countBuf_(0)
+    , visibilityBuf_(0)
+    , readbackBuf_(0)
+    , drawCapacity_(0)
+    , readback_(nullptr)
+    , readbackFences_{}
+    , readbackFrame_(0)
+    , lastCounters_{}
+    , depthSource_(0)
+    , depthWidth_(0)
+    , depthHeight_(0)
+    , hiZ_(0)
+    , hiZWidth_(0)
+    , hiZHeight_(0)
+    , hiZLevels_(0)
+    , occlusionWanted_(true)
+    , pool_(nullptr)
+    , planes_{}
+    , viewProjection_(1.f)
+    , slots_(0)
+    , mismatches_(0)
+    , verify_(false)
+    , verified_(false)
+{
+
+}
+
+bool ChunkCuller::initialize() {
+    cullShader_ = Shader("src/res/shaders/ChunkCull.shader");
+    hiZShader_ = Shader("src/res/shaders/HiZBuild.shader");
+
+    GLCall(glCreateBuffers(1, &countBuf_));
+    GLCall(glNamedBufferStorage(countBuf_, sizeof(CullCounters), nullptr, GL_DYNAMIC_STORAGE_BIT));
+
+    // One set of counters per frame in flight so reading the stats never waits on the GPU
+    GLCall(glCreateBuffers(1, &readbackBuf_));
+    GLCall(glNamedBufferStorage(readbackBuf_, sizeof(CullCounters) * READBACK_FRAMES, nullptr,
+        GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT));
+    readback_ = (CullCounters*)glMapNamedBufferRange(readbackBuf_, 0, sizeof(CullCounters) * READBACK_FRAMES,
+        GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+    if (!readback_) {
+        std::cerr << "ChunkCuller ERROR: failed to map readback buffer\n";
+        return false;
+    }
+
+    return true;
+}
+
+void ChunkCuller::destroy() {
+    for (GLsync& fence : readbackFences_) {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (readback_) glUnmapNamedBuffer(readbackBuf_);
+    readback_ = nullptr;
+
+    glDeleteBuffers(1, &drawBuf_);
+    glDeleteBuffers(1, &countBuf_);
+    glDeleteBuffers(1, &visibilityBuf_);
+    glDeleteBuffers(1, &readbackBuf_);
+    glDeleteTextures(1, &hiZ_);
+    drawBuf_ = countBuf_ = visibilityBuf_ = readbackBuf_ = hiZ_ = 0;
+    drawCapacity_ = 0;
+
+    cullShader_.deleteProgram();
+    hiZShader_.deleteProgram();
+}
+
+void ChunkCuller::setDepthSource(GLuint depthTexture, int width, int height) {
+    depthSource_ = depthTexture;
+    depthWidth_ = width;
+    depthHeight_ = height;
+}
+
+void ChunkCuller::cull(const VertexPool& pool, const std::array<glm::vec4, 6>& planes, const glm::mat4& viewProjection) {
+    pool_ = &pool;
+    planes_ = planes;
+    viewProjection_ = viewProjection;
+    slots_ = pool.getSlotCount();
+
+    GLCall(glClearNamedBufferData(countBuf_, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr));
+    if (slots_ == 0) return;
+
+    // Each phase writes its survivors densely into its own half, so neither needs more room than there are slots
+    if (drawCapacity_ < slots_) {
+        glDeleteBuffers(1, &drawBuf_);
+        glDeleteBuffers(1, &visibilityBuf_);
+        drawCapacity_ = std::max<size_t>(slots_, drawCapacity_ * 2);
+        GLCall(glCreateBuffers(1, &drawBuf_));
+        GLCall(glNamedBufferStorage(drawBuf_, sizeof(DrawElementsIndirectCommand) * drawCapacity_ * 2, nullptr, 0));
+        // Starts out as all outside, so the first frame after growing draws everything through phase 2
+        GLCall(glCreateBuffers(1, &visibilityBuf_));
+        GLCall(glNamedBufferStorage(visibilityBuf_, sizeof(GLuint) * drawCapacity_, nullptr, 0));
+        GLCall(glClearNamedBufferData(visibilityBuf_, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr));
+    }
+
+    dispatchCull(0);
+}
+
+void ChunkCuller::dispatchCull(GLuint phase) {
+    cullShader_.use();
+    cullShader_.setUint("slotCount", slots_);
+    cullShader_.setUint("drawCapacity", (GLuint)drawCapacity_);
+    cullShader_.setUint("cullPhase", phase);
+    cullShader_.setBool("useOcclusion", occlusionActive());
+    cullShader_.setVec4Array("frustumPlanes", planes_.data(), 6);
+    cullShader_.setUniform4fv("viewProjection", viewProjection_);
+    cullShader_.setInt("hiZ", 0);
+
+    if (phase == 1) {
+        GLCall(glBindTextureUnit(0, hiZ_));
+    }
+
+    GLCall(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, pool_->getIndirectBuf()));
+    GLCall(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, pool_->getBoundsBuf()));
+    GLCall(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, drawBuf_));
+    GLCall(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, countBuf_));
+    GLCall(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, visibilityBuf_));
+    GLCall(glDispatchCompute((slots_ + 63) / 64, 1, 1));
+    GLCall(glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT));
+
+    if (phase == 1) {
+        GLCall(glBindTextureUnit(0, 0));
+    }
+}
+
+void ChunkCuller::draw() const {
+    if (slots_ == 0) return;
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawBuf_);
+    glBindBuffer(GL_PARAMETER_BUFFER, countBuf_);
+    glMultiDrawElementsIndirectCount(
+        GL_TRIANGLES,
+        GL_UNSIGNED_INT,
+        nullptr,
+        0,
+        (GLsizei)slots_,
+        0
+    );
+}
+
+void ChunkCuller::cullOccluded() {
+    if (slots_ == 0 || !occlusionActive()) return;
+
+    buildHiZ();
+    dispatchCull(1);
+}
+
+void ChunkCuller::drawDisoccluded() const {
+    if (slots_ == 0 || !occlusionActive()) return;
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawBuf_);
+    glBindBuffer(GL_PARAMETER_BUFFER, countBuf_);
+    glMultiDrawElementsIndirectCount(
+        GL_TRIANGLES,
+        GL_UNSIGNED_INT,
+        (void*)(sizeof(DrawElementsIndirectCommand) * drawCapacity_),
+        sizeof(GLuint),
+        (GLsizei)slots_,
+        0
+    );
+}
+
+void ChunkCuller::buildHiZ() {
+    // Level 0 is the largest power of two that fits the depth buffer, so every level below halves exactly
+    // and a texel's footprint in uv space is the same at every level
+    auto floorPow2 = [](int v) { int p = 1; while (p * 2 <= v) p *= 2; return p; };
+    int width = floorPow2(std::max(depthWidth_, 1));
+    int height = floorPow2(std::max(depthHeight_, 1));
+
+    if (width != hiZWidth_ || height != hiZHeight_) {
+        glDeleteTextures(1, &hiZ_);
+        hiZWidth_ = width;
+        hiZHeight_ = height;
+        hiZLevels_ = (int)std::log2(std::max(width, height)) + 1;
+        GLCall(glCreateTextures(GL_TEXTURE_2D, 1, &hiZ_));
+        GLCall(glTextureStorage2D(hiZ_, hiZLevels_, GL_R32F, width, height));
+        GLCall(glTextureParameteri(hiZ_, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST));
+        GLCall(glTextureParameteri(hiZ_, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    }
+
+    hiZShader_.use();
+    hiZShader_.setInt("depthTexture", 0);
+    GLCall(glBindTextureUnit(0, depthSource_));
+
+    int srcWidth = depthWidth_, srcHeight = depthHeight_;
+    for (int level = 0; level < hiZLevels_; ++level) {
+        int dstWidth = std::max(width >> level, 1);
+        int dstHeight = std::max(height >> level, 1);
+
+        hiZShader_.setBool("fromDepth", level == 0);
+        hiZShader_.setIvec2("srcSize", srcWidth, srcHeight);
+        GLCall(glBindImageTexture(0, hiZ_, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F));
+        GLCall(glBindImageTexture(1, hiZ_, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F));
+        GLCall(glDispatchCompute((dstWidth + 7) / 8, (dstHeight + 7) / 8, 1));
+        GLCall(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT));
+
+        srcWidth = dstWidth;
+        srcHeight = dstHeight;
+    }
+
+    // The depth texture is still attached to the framebuffer phase 2 draws into
+    GLCall(glBindTextureUnit(0, 0));
+}
+
+void ChunkCuller::endFrame() {
+    // Pick up the oldest counters if their frame has finished, then queue this frame's into their place
+    GLsync& fence = readbackFences_[readbackFrame_];
+    if (fence) {
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+            lastCounters_ = readback_[readbackFrame_];
+        }
+        glDeleteSync(fence);
+    }
+    GLCall(glCopyNamedBufferSubData(countBuf_, readbackBuf_, 0, sizeof(CullCounters) * readbackFrame_, sizeof(CullCounters)));
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readbackFrame_ = (readbackFrame_ + 1) % READBACK_FRAMES;
+
+    verified_ = verify_ && slots_ != 0;
+    if (verified_) verifyDrawLists();
+}
+
+ChunkCullStats ChunkCuller::getStats() const {
+    return {
+        (size_t)slots_,
+        lastCounters_.frustumPassed,
+        (size_t)lastCounters_.drawCounts[0] + lastCounters_.drawCounts[1],
+        lastCounters_.occluded,
+        lastCounters_.occludedTriangles,
+        mismatches_,
+        occlusionActive(),
+        verified_
+    };
+}
+
+ChunkCuller::Visibility ChunkCuller::cullOnCpu(const DrawElementsIndirectCommand& cmd, const SlotBounds& bounds, const std::array<glm::vec4, 6>& planes) {
+    if (cmd.count == 0 || cmd.instanceCount == 0) return Visibility::Outside;
+
+    constexpr float EPSILON = 0.05f;    // world units, well above float error at render distances
+    bool ambiguous = false;
+    for (const auto& plane : planes) {
+        glm::vec3 corner(
+            plane.x >= 0.f ? bounds.maxCorner.x : bounds.minCorner.x,
+            plane.y >= 0.f ? bounds.maxCorner.y : bounds.minCorner.y,
+            plane.z >= 0.f ? bounds.maxCorner.z : bounds.minCorner.z
+        );
+        float distance = glm::dot(glm::vec3(plane), corner) + plane.w;
+        if (distance < -EPSILON) return Visibility::Outside;
+        if (distance < EPSILON) ambiguous = true;
+    }
+
+    return ambiguous ? Visibility::Ambiguous : Visibility::Inside;
+}
+
+void ChunkCuller::verifyDrawLists() {
+    const auto& commands = pool_->getSlotCommands();
+    const auto& bounds = pool_->getSlotBounds();
+
+    // Stalls until both cull passes have run, which is why this is opt-in
+    CullCounters counters = {};
+    std::vector<GLuint> visibility(slots_);
+    GLCall(glGetNamedBufferSubData(countBuf_, 0, sizeof(CullCounters), &counters));
+    GLCall(glGetNamedBufferSubData(visibilityBuf_, 0, sizeof(GLuint) * slots_, visibility.data()));
+
+    size_t mismatches = 0;
+    std::vector<bool> drawnByGpu(slots_, false);
+    for (int list = 0; list < 2; ++list) {
+        GLuint count = counters.drawCounts[list];
+        if (count > slots_) {
+            mismatches += count - slots_;
+            count = slots_;
+        }
+
+        std::vector<DrawElementsIndirectCommand> gpuDraws(count);
+        if (!gpuDraws.empty()) {
+            GLCall(glGetNamedBufferSubData(drawBuf_, sizeof(DrawElementsIndirectCommand) * drawCapacity_ * list,
+                sizeof(DrawElementsIndirectCommand) * gpuDraws.size(), gpuDraws.data()));
+        }
+
+        for (const auto& draw : gpuDraws) {
+            GLuint slot = draw.baseInstance;
+            const bool valid = slot < slots_ && !drawnByGpu[slot]
+                && draw.count == commands[slot].count
+                && draw.firstIndex == commands[slot].firstIndex
+                && draw.baseVertex == commands[slot].baseVertex;
+            if (!valid) {
+                ++mismatches;
+                continue;
+            }
+            drawnByGpu[slot] = true;
+        }
+    }
+
+    // Occlusion isn't reproduced on the CPU, but every slot inside the frustum must have been classified
+    // and every one classified visible must have been drawn by one of the phases
+    constexpr GLuint OUTSIDE = 0, VISIBLE = 1;
+    for (GLuint slot = 0; slot < slots_; ++slot) {
+        Visibility expected = cullOnCpu(commands[slot], bounds[slot], planes_);
+        if (expected == Visibility::Outside) {
+            if (drawnByGpu[slot] || visibility[slot] != OUTSIDE) ++mismatches;
+        }
+        else if (expected == Visibility::Inside) {
+            if (visibility[slot] == OUTSIDE || (visibility[slot] == VISIBLE && !drawnByGpu[slot])) ++mismatches;
+        }
+    }
+
+    if (mismatches && !mismatches_) {
+        std::cerr << "ChunkCuller ERROR: GPU draw lists differ from the CPU reference in " << mismatches << " slots\n";
+    }
+    mismatches_ = mismatches;
+}
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "h/Rendering/ChunkQuadtree.h"
+
+#include <xmmintrin.h>
+#include <algorithm>
+
+ChunkQuadtree::ChunkQuadtree()
+    : revision_(0)
+    , planes_{}
+    , stats_{}
+{
+
+}
+
+void ChunkQuadtree::setChunkHeights(const ChunkUtils::ChunkCoordPair& key, int minY, int maxY) {
+    std::lock_guard<std::mutex> lock(treeMtx_);
+    levels_[0][key] = { minY, maxY, 1 };
+    refreshParents(key);
+    ++revision_;
+}
+
+void ChunkQuadtree::removeChunk(const ChunkUtils::ChunkCoordPair& key) {
+    std::lock_guard<std::mutex> lock(treeMtx_);
+    if (levels_[0].erase(key) == 0) return;
+    refreshParents(key);
+    ++revision_;
+}
+
+uint64_t ChunkQuadtree::getRevision() const {
+    std::lock_guard<std::mutex> lock(treeMtx_);
+    return revision_;
+}
+
+void ChunkQuadtree::refreshParents(const ChunkUtils::ChunkCoordPair& key) {
+    // Arithmetic shifts keep negative coordinates in the right node
+    for (int level = 1; level < LEVELS; ++level) {
+        ChunkUtils::ChunkCoordPair node = { key.first >> level, key.second >> level };
+
+        NodeBounds bounds = { ChunkUtils::HEIGHT, 0, 0 };
+        for (int child = 0; child < 4; ++child) {
+            auto it = levels_[level - 1].find({ node.first * 2 + (child & 1), node.second * 2 + (child >> 1) });
+            if (it == levels_[level - 1].end()) continue;
+            bounds.minY = std::min(bounds.minY, it->second.minY);
+            bounds.maxY = std::max(bounds.maxY, it->second.maxY);
+            bounds.chunks += it->second.chunks;
+        }
+
+        if (bounds.chunks == 0) levels_[level].erase(node);
+        else levels_[level][node] = bounds;
+    }
+}
+
+std::vector<ChunkUtils::ChunkCoordPair> ChunkQuadtree::getVisibleChunks(const std::array<glm::vec4, 6>& planes, const ChunkUtils::ChunkCoordPair& center, int renderRadius) {
+    std::vector<ChunkUtils::ChunkCoordPair> visible;
+    stats_ = {};
+    planes_ = planes;
+    if (renderRadius < 0) return visible;
+
+    Region region = { center.first - renderRadius, center.second - renderRadius, center.first + renderRadius, center.second + renderRadius };
+    const int top = LEVELS - 1;
+
+    std::lock_guard<std::mutex> lock(treeMtx_);
+    for (int nodeX = region.minX >> top; nodeX <= region.maxX >> top; ++nodeX) {
+        for (int nodeZ = region.minZ >> top; nodeZ <= region.maxZ >> top; ++nodeZ) {
+            cullNode(top, nodeX, nodeZ, region, visible);
+        }
+    }
+
+    stats_.visible = visible.size();
+    return visible;
+}
+
+ChunkQuadtree::Containment ChunkQuadtree::classify(int level, int nodeX, int nodeZ, const NodeBounds& bounds, const Region& region) const {
+    // Only the part of the node inside the render square matters
+    glm::vec3 lo(
+        (float)std::max(nodeX << level, region.minX) * ChunkUtils::WIDTH,
+        (float)bounds.minY,
+        (float)std::max(nodeZ << level, region.minZ) * ChunkUtils::DEPTH);
+    glm::vec3 hi(
+        (float)(std::min(((nodeX + 1) << level) - 1, region.maxX) + 1) * ChunkUtils::WIDTH,
+        (float)bounds.maxY,
+        (float)(std::min(((nodeZ + 1) << level) - 1, region.maxZ) + 1) * ChunkUtils::DEPTH);
+
+    Containment result = Containment::Inside;
+    for (const auto& plane : planes_) {
+        glm::vec3 normal(plane);
+        // Corner furthest along the normal decides outside, the one furthest against it decides inside
+        glm::vec3 positive(normal.x >= 0.f ? hi.x : lo.x, normal.y >= 0.f ? hi.y : lo.y, normal.z >= 0.f ? hi.z : lo.z);
+        glm::vec3 negative(normal.x >= 0.f ? lo.x : hi.x, normal.y >= 0.f ? lo.y : hi.y, normal.z >= 0.f ? lo.z : hi.z);
+        if (glm::dot(normal, positive) + plane.w < 0.f) return Containment::Outside;
+        if (glm::dot(normal, negative) + plane.w < 0.f) result = Containment::Intersecting;
+    }
+    return result;
+}
+
+void ChunkQuadtree::cullNode(int level, int nodeX, int nodeZ, const Region& region, std::vector<ChunkUtils::ChunkCoordPair>& out) {
+    int firstX = nodeX << level, firstZ = nodeZ << level;
+    int lastX = ((nodeX + 1) << level) - 1, lastZ = ((nodeZ + 1) << level) - 1;
+    if (lastX < region.minX || firstX > region.maxX || lastZ < region.minZ || firstZ > region.maxZ) return;
+
+    auto it = levels_[level].find({ nodeX, nodeZ });
+    if (it == levels_[level].end()) return;
+    ++stats_.nodesTested;
+
+    switch (classify(level, nodeX, nodeZ, it->second, region)) {
+    case Containment::Outside:
+        return;
+    case Containment::Inside: {
+        size_t before = out.size();
+        acceptNode(level, nodeX, nodeZ, region, out);
+        stats_.acceptedWhole += out.size() - before;
+        return;
+    }
+    case Containment::Intersecting:
+        break;
+    }
+
+    if (level == LEAF_LEVEL) {
+        cullLeaf(nodeX, nodeZ, region, out);
+        return;
+    }
+    for (int child = 0; child < 4; ++child) {
+        cullNode(level - 1, nodeX * 2 + (child & 1), nodeZ * 2 + (child >> 1), region, out);
+    }
+}
+
+void ChunkQuadtree::acceptNode(int level, int nodeX, int nodeZ, const Region& region, std::vector<ChunkUtils::ChunkCoordPair>& out) {
+    if (levels_[level].find({ nodeX, nodeZ }) == levels_[level].end()) return;
+
+    if (level == 0) {
+        if (nodeX >= region.minX && nodeX <= region.maxX && nodeZ >= region.minZ && nodeZ <= region.maxZ) {
+            out.push_back({ nodeX, nodeZ });
+        }
+        return;
+    }
+    for (int child = 0; child < 4; ++child) {
+        acceptNode(level - 1, nodeX * 2 + (child & 1), nodeZ * 2 + (child >> 1), region, out);
+    }
+}
+
+void ChunkQuadtree::cullLeaf(int nodeX, int nodeZ, const Region& region, std::vector<ChunkUtils::ChunkCoordPair>& out) {
+    const int side = 1 << LEAF_LEVEL;
+
+    // Gather the leaf's meshed chunks inside the render square, structure-of-arrays for the SSE test
+    alignas(16) float minX[side * side] = {}, minY[side * side] = {}, minZ[side * side] = {};
+    alignas(16) float maxX[side * side] = {}, maxY[side * side] = {}, maxZ[side * side] = {};
+    ChunkUtils::ChunkCoordPair keys[side * side];
+    int count = 0;
+
+    for (int dz = 0; dz < side; ++dz) {
+        for (int dx = 0; dx < side; ++dx) {
+            ChunkUtils::ChunkCoordPair key = { nodeX * side + dx, nodeZ * side + dz };
+            if (key.first < region.minX || key.first > region.maxX || key.second < region.minZ || key.second > region.maxZ) continue;
+            auto it = levels_[0].find(key);
+            if (it == levels_[0].end()) continue;
+
+            keys[count] = key;
+            minX[count] = (float)key.first * ChunkUtils::WIDTH;
+            maxX[count] = minX[count] + ChunkUtils::WIDTH;
+            minZ[count] = (float)key.second * ChunkUtils::DEPTH;
+            maxZ[count] = minZ[count] + ChunkUtils::DEPTH;
+            minY[count] = (float)it->second.minY;
+            maxY[count] = (float)it->second.maxY;
+            ++count;
+        }
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    for (int base = 0; base < count; base += 4) {
+        ++stats_.leafBatches;
+        __m128 loX = _mm_load_ps(minX + base), hiX = _mm_load_ps(maxX + base);
+        __m128 loY = _mm_load_ps(minY + base), hiY = _mm_load_ps(maxY + base);
+        __m128 loZ = _mm_load_ps(minZ + base), hiZ = _mm_load_ps(maxZ + base);
+
+        __m128 outside = _mm_setzero_ps();
+        for (const auto& plane : planes_) {
+            __m128 x = plane.x >= 0.f ? hiX : loX;
+            __m128 y = plane.y >= 0.f ? hiY : loY;
+            __m128 z = plane.z >= 0.f ? hiZ : loZ;
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, zero));
+        }
+
+        int outsideMask = _mm_movemask_ps(outside);
+        for (int lane = 0; lane < 4 && base + lane < count; ++lane) {
+            if (!((outsideMask >> lane) & 1)) out.push_back(keys[base + lane]);
+        }
+    }
+}
\ No newline at end of file
@@ -3,7 +3,9 @@
 PostProcessingPass::PostProcessingPass() 
 	: fbo_(0)
 	, color_(0)
-	, rbo_(0)
+	, depth_(0)
+	, width_(0)
+	, height_(0)
 	, vao_(0)
 	, vbo_(0)
 	, use_(true)
@@ -13,6 +15,8 @@ PostProcessingPass::PostProcessingPass()
 
 bool PostProcessingPass::init(int w, int h, const char* shaderPath) {
 	shader_ = Shader(shaderPath);
+	width_ = w;
+	height_ = h;
 
     // FBO + color
     GLCall(glGenFramebuffers(1, &fbo_));
@@ -27,10 +31,15 @@ bool PostProcessingPass::init(int w, int h, const char* shaderPath) {
     GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
     GLCall(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_, 0));
 
-    GLCall(glGenRenderbuffers(1, &rbo_));
-    GLCall(glBindRenderbuffer(GL_RENDERBUFFER, rbo_));
-    GLCall(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h));
-    GLCall(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo_));
+    // Depth is a texture rather than a renderbuffer so the terrain occlusion pass can build its Hi-Z pyramid from it
+    GLCall(glGenTextures(1, &depth_));
+    GLCall(glBindTexture(GL_TEXTURE_2D, depth_));
+    GLCall(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, w, h, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL));
+    GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    GLCall(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth_, 0));
 
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
         return false;
@@ -63,12 +72,14 @@ bool PostProcessingPass::init(int w, int h, const char* shaderPath) {
 }
 
 void PostProcessingPass::resize(int w, int h) {
-    if (!color_ || !rbo_) return;
+    if (!color_ || !depth_) return;
+    width_ = w;
+    height_ = h;
 
     GLCall(glBindTexture(GL_TEXTURE_2D, color_));
     GLCall(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr));
-    GLCall(glBindRenderbuffer(GL_RENDERBUFFER, rbo_));
-    GLCall(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h));
+    GLCall(glBindTexture(GL_TEXTURE_2D, depth_));
+    GLCall(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, w, h, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, nullptr));
 }
 
 void PostProcessingPass::beginScene() {
@@ -96,9 +107,9 @@ void PostProcessingPass::blitToScreen() {
 void PostProcessingPass::destroy() {
     if (vbo_) GLCall(glDeleteBuffers(1, &vbo_));
     if (vao_) GLCall(glDeleteVertexArrays(1, &vao_));
-    if (rbo_) GLCall(glDeleteRenderbuffers(1, &rbo_));
+    if (depth_) GLCall(glDeleteTextures(1, &depth_));
     if (color_) GLCall(glDeleteTextures(1, &color_));
     if (fbo_) GLCall(glDeleteFramebuffers(1, &fbo_));
-    vbo_ = vao_ = rbo_ = color_ = fbo_ = 0;
+    vbo_ = vao_ = depth_ = color_ = fbo_ = 0;
     shader_.deleteProgram();
 }
\ No newline at end of file
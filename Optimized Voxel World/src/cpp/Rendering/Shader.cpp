@@ -10,10 +10,10 @@ Shader::Shader() {
 
 Shader::Shader(const char* filepath) {
 	std::ifstream stream;
-	std::string vertexCode, fragmentCode;
+	std::string vertexCode, fragmentCode, computeCode;
 
 	enum class ShaderType {
-		NONE = -1, VERTEX = 0, FRAGMENT = 1
+		NONE = -1, VERTEX = 0, FRAGMENT = 1, COMPUTE = 2
 	};
 
 	stream.open(filepath);
@@ -21,7 +21,7 @@ Shader::Shader(const char* filepath) {
 		std::cout << "Failed to open shader file: " << filepath << std::endl;
 		return;
 	}
-	std::stringstream ss[2];
+	std::stringstream ss[3];
 	std::string line;
 
 	ShaderType type = ShaderType::NONE;
@@ -33,6 +33,9 @@ Shader::Shader(const char* filepath) {
 			else if (line.find("fragment") != std::string::npos) {
 				type = ShaderType::FRAGMENT;
 			}
+			else if (line.find("compute") != std::string::npos) {
+				type = ShaderType::COMPUTE;
+			}
 		}
 		else {
 			if (type == ShaderType::VERTEX) {
@@ -41,6 +44,9 @@ Shader::Shader(const char* filepath) {
 			else if (type == ShaderType::FRAGMENT) {
 				ss[1] << line << "\n";
 			}
+			else if (type == ShaderType::COMPUTE) {
+				ss[2] << line << "\n";
+			}
 		}
 	}
 
@@ -52,6 +58,37 @@ Shader::Shader(const char* filepath) {
 
 	vertexCode = ss[0].str();
 	fragmentCode = ss[1].str();
+	computeCode = ss[2].str();
+
+	int success;
+	char infoLog[512];
+
+	// A compute section makes this a compute program on its own
+	if (!computeCode.empty()) {
+		const char* cShaderCode = computeCode.c_str();
+		unsigned int compute;
+		GLCall(compute = glCreateShader(GL_COMPUTE_SHADER));
+		GLCall(glShaderSource(compute, 1, &cShaderCode, NULL));
+		GLCall(glCompileShader(compute));
+		GLCall(glGetShaderiv(compute, GL_COMPILE_STATUS, &success));
+		if (!success) {
+			GLCall(glGetShaderInfoLog(compute, 512, NULL, infoLog));
+			std::cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << "\n";
+		}
+
+		GLCall(id = glCreateProgram());
+		GLCall(glAttachShader(id, compute));
+		GLCall(glLinkProgram(id));
+
+		GLCall(glGetProgramiv(id, GL_LINK_STATUS, &success));
+		if (!success) {
+			GLCall(glGetProgramInfoLog(id, 512, NULL, infoLog));
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << "\n";
+		}
+
+		GLCall(glDeleteShader(compute));
+		return;
+	}
 
 	const char* vShaderCode = vertexCode.c_str();
 	const char* fShaderCode = fragmentCode.c_str();
@@ -59,8 +96,6 @@ Shader::Shader(const char* filepath) {
 
 	// Now compile shaders
 	unsigned int vertex, fragment;
-	int success;
-	char infoLog[512];
 	//vertex
 	GLCall(vertex = glCreateShader(GL_VERTEX_SHADER));
 	GLCall(glShaderSource(vertex, 1, &vShaderCode, NULL));
@@ -125,6 +160,18 @@ void Shader::setVec3(const std::string& name, glm::vec3& value) const {
 	GLCall(glUniform3f(glGetUniformLocation(id, name.c_str()), value.x, value.y, value.z));
 }
 
+void Shader::setUint(const std::string& name, unsigned int value) const {
+	GLCall(glUniform1ui(glGetUniformLocation(id, name.c_str()), value));
+}
+
+void Shader::setIvec2(const std::string& name, int x, int y) const {
+	GLCall(glUniform2i(glGetUniformLocation(id, name.c_str()), x, y));
+}
+
+void Shader::setVec4Array(const std::string& name, const glm::vec4* values, int count) const {
+	GLCall(glUniform4fv(glGetUniformLocation(id, name.c_str()), count, glm::value_ptr(values[0])));
+}
+
 void Shader::deleteProgram() {
 	GLCall(glDeleteProgram(id));
 }
\ No newline at end of file
@@ -0,0 +1,375 @@
+#include "h/Rendering/SoftwareOcclusionCuller.h"
+#include "h/Rendering/Camera.h"
+#include "h/Rendering/ChunkQuadtree.h"
+#include "h/Terrain/ChunkLoader.h"
+#include "h/Terrain/ProcGen/ProcGen.h"
+
+#include <xmmintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+SoftwareOcclusionCuller::SoftwareOcclusionCuller()
+    : depth_(BUFFER_WIDTH * BUFFER_HEIGHT, 0.f)
+    , viewProjection_(1.f)
+    , stats_{}
+{
+
+}
+
+ChunkOccluder SoftwareOcclusionCuller::buildOccluder(const std::vector<BlockID>& blocks, int lod) {
+    const int res = 1 << lod;
+    const int width = ChunkUtils::WIDTH >> lod;
+    const int height = ChunkUtils::HEIGHT >> lod;
+    auto solid = [&](int x, int y, int z) {
+        BlockID block = blocks[ChunkUtils::flattenChunkCoords(x, y, z, lod)];
+        return block != BlockID::AIR && block != BlockID::NONE;
+    };
+
+    ChunkOccluder occluder;
+    occluder.top = 0;
+    occluder.minFloor = ChunkUtils::HEIGHT;
+
+    for (int cz = 0; cz < ChunkOccluder::CELLS; ++cz) {
+        for (int cx = 0; cx < ChunkOccluder::CELLS; ++cx) {
+            // At the coarsest levels several cells share one column
+            int x0 = cx * width / ChunkOccluder::CELLS, x1 = std::max(x0 + 1, (cx + 1) * width / ChunkOccluder::CELLS);
+            int z0 = cz * width / ChunkOccluder::CELLS, z1 = std::max(z0 + 1, (cz + 1) * width / ChunkOccluder::CELLS);
+
+            int cellFloor = height;
+            for (int z = z0; z < z1; ++z) {
+                for (int x = x0; x < x1; ++x) {
+                    int solidTo = 0;
+                    while (solidTo < height && solid(x, solidTo, z)) ++solidTo;
+                    cellFloor = std::min(cellFloor, solidTo);
+
+                    int top = height;
+                    while (top > solidTo && !solid(x, top - 1, z)) --top;
+                    occluder.top = std::max(occluder.top, top * res);
+                }
+            }
+
+            occluder.floors[cx + cz * ChunkOccluder::CELLS] = cellFloor * res;
+            occluder.minFloor = std::min(occluder.minFloor, cellFloor * res);
+        }
+    }
+
+    return occluder;
+}
+
+void SoftwareOcclusionCuller::setOccluder(const ChunkUtils::ChunkCoordPair& key, const ChunkOccluder& occluder) {
+    std::lock_guard<std::mutex> lock(occluderMtx_);
+    occluders_[key] = occluder;
+}
+
+void SoftwareOcclusionCuller::removeOccluder(const ChunkUtils::ChunkCoordPair& key) {
+    std::lock_guard<std::mutex> lock(occluderMtx_);
+    occluders_.erase(key);
+}
+
+void SoftwareOcclusionCuller::cull(std::vector<ChunkUtils::ChunkCoordPair>& visibleChunks, const glm::mat4& viewProjection, const glm::vec3& cameraPos) {
+    auto start = std::chrono::steady_clock::now();
+    viewProjection_ = viewProjection;
+    stats_ = {};
+
+    std::fill(depth_.begin(), depth_.end(), 0.f);
+    rasterizeOccluders(visibleChunks, cameraPos);
+    auto rasterized = std::chrono::steady_clock::now();
+
+    std::vector<glm::vec2> heightRanges(visibleChunks.size());
+    {
+        std::lock_guard<std::mutex> lock(occluderMtx_);
+        for (size_t i = 0; i < visibleChunks.size(); ++i) {
+            auto it = occluders_.find(visibleChunks[i]);
+            // Not meshed yet, assume the whole column could be visible
+            heightRanges[i] = it == occluders_.end()
+                ? glm::vec2(0.f, (float)ChunkUtils::HEIGHT)
+                : glm::vec2((float)it->second.minFloor, (float)it->second.top);
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < visibleChunks.size(); ++i) {
+        const auto& key = visibleChunks[i];
+        glm::vec3 lo(key.first * ChunkUtils::WIDTH, heightRanges[i].x, key.second * ChunkUtils::DEPTH);
+        glm::vec3 hi(lo.x + ChunkUtils::WIDTH, heightRanges[i].y, lo.z + ChunkUtils::DEPTH);
+
+        if (isOccluded(lo, hi)) continue;
+        visibleChunks[kept++] = key;
+    }
+
+    stats_.tested = visibleChunks.size();
+    stats_.occluded = visibleChunks.size() - kept;
+    visibleChunks.resize(kept);
+
+    auto end = std::chrono::steady_clock::now();
+    stats_.rasterMs = std::chrono::duration<double, std::milli>(rasterized - start).count();
+    stats_.testMs = std::chrono::duration<double, std::milli>(end - rasterized).count();
+}
+
+SoftwareCullBenchmarkResult SoftwareOcclusionCuller::benchmark(const ProcGen& procGen, int radius) {
+    const glm::mat4 projection = glm::perspective(glm::radians((float)WindowDetails::FOV),
+        (float)WindowDetails::WindowWidth / (float)WindowDetails::WindowHeight, 0.1f, 20000.0f);
+    const LodSelector selector = LodSelector::fromScreenSpaceError(projection[1][1], WindowDetails::WindowHeight, LodSelector::DEFAULT_MAX_ERROR_PIXELS);
+    const int valleySearch = 2;     // chunks around the origin searched for the lowest column
+
+    SoftwareCullBenchmarkResult result = { 0, 0.0, {} };
+    SoftwareOcclusionCuller culler;
+    ChunkQuadtree tree;
+    glm::vec3 valley(0.f, (float)ChunkUtils::HEIGHT, 0.f);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<BlockID> blocks;
+    for (int x = -radius; x <= radius; ++x) {
+        for (int z = -radius; z <= radius; ++z) {
+            int lod = selector.levelOfDetail(x, z, false);
+            blocks.assign(ChunkUtils::getChunkLength(lod), BlockID::AIR);
+            procGen.generateChunk(blocks, { x, z }, lod, false);
+
+            ChunkOccluder occluder = buildOccluder(blocks, lod);
+            culler.setOccluder({ x, z }, occluder);
+            tree.setChunkHeights({ x, z }, occluder.minFloor, occluder.top);
+            ++result.chunks;
+
+            if (std::abs(x) > valleySearch || std::abs(z) > valleySearch) continue;
+            const int res = 1 << lod, width = ChunkUtils::WIDTH >> lod, height = ChunkUtils::HEIGHT >> lod;
+            for (int lx = 0; lx < width; ++lx) {
+                for (int lz = 0; lz < width; ++lz) {
+                    int top = height;
+                    while (top > 0) {
+                        BlockID block = blocks[ChunkUtils::flattenChunkCoords(lx, top - 1, lz, lod)];
+                        if (block != BlockID::AIR && block != BlockID::NONE) break;
+                        --top;
+                    }
+                    if (top * res >= valley.y) continue;
+                    valley = glm::vec3(x * ChunkUtils::WIDTH + (lx + 0.5f) * res, (float)(top * res), z * ChunkUtils::DEPTH + (lz + 0.5f) * res);
+                }
+            }
+        }
+    }
+    result.generateSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const ChunkOccluder& origin = culler.occluders_[{ 0, 0 }];
+    const glm::vec3 originCentre(ChunkUtils::WIDTH * 0.5f, 0.f, ChunkUtils::DEPTH * 0.5f);
+    struct Pose { const char* name; glm::vec3 position; float pitch; };
+    const Pose poses[] = {
+        { "surface", originCentre + glm::vec3(0.f, origin.top + 2.f, 0.f), -10.f },
+        { "valley", valley + glm::vec3(0.f, 2.f, 0.f), 0.f },
+        { "underground", originCentre + glm::vec3(0.f, origin.minFloor * 0.5f, 0.f), 0.f },
+    };
+
+    for (const Pose& pose : poses) {
+        SoftwareCullBenchmarkPose measured = { pose.name, pose.position, 0, 0, 0.0, 0.0 };
+        const ChunkUtils::ChunkCoordPair centre = {
+            ChunkUtils::worldToChunkCoord((int)std::floor(pose.position.x)),
+            ChunkUtils::worldToChunkCoord((int)std::floor(pose.position.z))
+        };
+
+        const int views = 4;
+        for (int view = 0; view < views; ++view) {
+            float yaw = glm::radians(90.f * view), pitch = glm::radians(pose.pitch);
+            glm::vec3 front(std::cos(yaw) * std::cos(pitch), std::sin(pitch), std::sin(yaw) * std::cos(pitch));
+            glm::mat4 viewProjection = projection * glm::lookAt(pose.position, pose.position + front, glm::vec3(0.f, 1.f, 0.f));
+
+            std::vector<ChunkUtils::ChunkCoordPair> visible = tree.getVisibleChunks(Camera::extractFrustumPlanes(viewProjection), centre, radius);
+            culler.cull(visible, viewProjection, pose.position);
+
+            SoftwareCullStats stats = culler.getStats();
+            measured.tested += stats.tested;
+            measured.occluded += stats.occluded;
+            measured.rasterMs += stats.rasterMs / views;
+            measured.testMs += stats.testMs / views;
+        }
+        result.poses.push_back(measured);
+    }
+
+    return result;
+}
+
+void SoftwareOcclusionCuller::rasterizeOccluders(const std::vector<ChunkUtils::ChunkCoordPair>& visibleChunks, const glm::vec3& cameraPos) {
+    std::vector<std::pair<float, std::pair<ChunkUtils::ChunkCoordPair, ChunkOccluder>>> nearest;
+    {
+        std::lock_guard<std::mutex> lock(occluderMtx_);
+        nearest.reserve(visibleChunks.size());
+        for (const auto& key : visibleChunks) {
+            auto it = occluders_.find(key);
+            if (it == occluders_.end()) continue;
+
+            float dx = (key.first + 0.5f) * ChunkUtils::WIDTH - cameraPos.x;
+            float dz = (key.second + 0.5f) * ChunkUtils::DEPTH - cameraPos.z;
+            nearest.push_back({ dx * dx + dz * dz, { key, it->second } });
+        }
+    }
+
+    size_t count = std::min(nearest.size(), MAX_OCCLUDER_CHUNKS);
+    std::partial_sort(nearest.begin(), nearest.begin() + count, nearest.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    const int cellSize = ChunkUtils::WIDTH / ChunkOccluder::CELLS;
+    for (size_t n = 0; n < count; ++n) {
+        const ChunkUtils::ChunkCoordPair& key = nearest[n].second.first;
+        const ChunkOccluder& occluder = nearest[n].second.second;
+
+        for (int cz = 0; cz < ChunkOccluder::CELLS; ++cz) {
+            for (int cx = 0; cx < ChunkOccluder::CELLS; ++cx) {
+                float f = (float)occluder.floors[cx + cz * ChunkOccluder::CELLS];
+                if (f <= 0.f) continue;
+
+                float x0 = (float)(key.first * ChunkUtils::WIDTH + cx * cellSize), x1 = x0 + cellSize;
+                float z0 = (float)(key.second * ChunkUtils::DEPTH + cz * cellSize), z1 = z0 + cellSize;
+                // A side face is hidden when the neighbouring cell in the same chunk is at least as tall
+                auto neighbourCovers = [&](int nx, int nz) {
+                    if (nx < 0 || nz < 0 || nx >= ChunkOccluder::CELLS || nz >= ChunkOccluder::CELLS) return false;
+                    return occluder.floors[nx + nz * ChunkOccluder::CELLS] >= f;
+                };
+
+                if (cameraPos.y > f) {
+                    rasterizeQuad({ x0, f, z0 }, { x1, f, z0 }, { x1, f, z1 }, { x0, f, z1 });
+                    ++stats_.occluderQuads;
+                }
+                if (cameraPos.x < x0 && !neighbourCovers(cx - 1, cz)) {
+                    rasterizeQuad({ x0, 0.f, z0 }, { x0, f, z0 }, { x0, f, z1 }, { x0, 0.f, z1 });
+                    ++stats_.occluderQuads;
+                }
+                else if (cameraPos.x > x1 && !neighbourCovers(cx + 1, cz)) {
+                    rasterizeQuad({ x1, 0.f, z0 }, { x1, f, z0 }, { x1, f, z1 }, { x1, 0.f, z1 });
+                    ++stats_.occluderQuads;
+                }
+                if (cameraPos.z < z0 && !neighbourCovers(cx, cz - 1)) {
+                    rasterizeQuad({ x0, 0.f, z0 }, { x0, f, z0 }, { x1, f, z0 }, { x1, 0.f, z0 });
+                    ++stats_.occluderQuads;
+                }
+                else if (cameraPos.z > z1 && !neighbourCovers(cx, cz + 1)) {
+                    rasterizeQuad({ x0, 0.f, z1 }, { x0, f, z1 }, { x1, f, z1 }, { x1, 0.f, z1 });
+                    ++stats_.occluderQuads;
+                }
+            }
+        }
+    }
+}
+
+SoftwareOcclusionCuller::ScreenVertex SoftwareOcclusionCuller::toScreen(const glm::vec4& clip) const {
+    float invW = 1.f / clip.w;
+    return {
+        (clip.x * invW * 0.5f + 0.5f) * BUFFER_WIDTH,
+        (clip.y * invW * 0.5f + 0.5f) * BUFFER_HEIGHT,
+        invW
+    };
+}
+
+void SoftwareOcclusionCuller::rasterizeQuad(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d) {
+    glm::vec4 in[4] = {
+        viewProjection_ * glm::vec4(a, 1.f), viewProjection_ * glm::vec4(b, 1.f),
+        viewProjection_ * glm::vec4(c, 1.f), viewProjection_ * glm::vec4(d, 1.f)
+    };
+
+    // Clip against the near plane (z >= -w), a quad gains at most one vertex
+    glm::vec4 out[5];
+    int outCount = 0;
+    for (int i = 0; i < 4; ++i) {
+        const glm::vec4& p = in[i];
+        const glm::vec4& q = in[(i + 1) % 4];
+        float dp = p.z + p.w, dq = q.z + q.w;
+        if (dp >= 0.f) out[outCount++] = p;
+        if ((dp >= 0.f) != (dq >= 0.f)) out[outCount++] = p + (q - p) * (dp / (dp - dq));
+    }
+    if (outCount < 3) return;
+
+    ScreenVertex screen[5];
+    for (int i = 0; i < outCount; ++i) screen[i] = toScreen(out[i]);
+    for (int i = 1; i + 1 < outCount; ++i) rasterizeTriangle(screen[0], screen[i], screen[i + 1]);
+}
+
+void SoftwareOcclusionCuller::rasterizeTriangle(ScreenVertex v0, ScreenVertex v1, ScreenVertex v2) {
+    float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+    if (area == 0.f) return;
+    if (area < 0.f) {
+        std::swap(v1, v2);
+        area = -area;
+    }
+
+    auto clampTo = [](float v, int hi) { return (int)std::min(std::max(v, 0.f), (float)hi); };
+    int minX = clampTo(std::floor(std::min({ v0.x, v1.x, v2.x })), BUFFER_WIDTH - 1) & ~3;
+    int maxX = clampTo(std::ceil(std::max({ v0.x, v1.x, v2.x })), BUFFER_WIDTH - 1);
+    int minY = clampTo(std::floor(std::min({ v0.y, v1.y, v2.y })), BUFFER_HEIGHT - 1);
+    int maxY = clampTo(std::ceil(std::max({ v0.y, v1.y, v2.y })), BUFFER_HEIGHT - 1);
+
+    // Edge functions e(p) = A * x + B * y + C, each one is non-negative on the triangle's side of its edge
+    auto edge = [](const ScreenVertex& a, const ScreenVertex& b, float& A, float& B, float& C) {
+        A = a.y - b.y;
+        B = b.x - a.x;
+        C = a.x * b.y - a.y * b.x;
+    };
+    float A0, B0, C0, A1, B1, C1, A2, B2, C2;
+    edge(v1, v2, A0, B0, C0);
+    edge(v2, v0, A1, B1, C1);
+    edge(v0, v1, A2, B2, C2);
+
+    // 1/w is affine in screen space, fold the barycentric weights into one plane equation
+    float invArea = 1.f / area;
+    float Zx = (A0 * v0.invW + A1 * v1.invW + A2 * v2.invW) * invArea;
+    float Zy = (B0 * v0.invW + B1 * v1.invW + B2 * v2.invW) * invArea;
+    float Z0 = (C0 * v0.invW + C1 * v1.invW + C2 * v2.invW) * invArea;
+
+    const __m128 laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 a0 = _mm_set1_ps(A0), a1 = _mm_set1_ps(A1), a2 = _mm_set1_ps(A2), zx = _mm_set1_ps(Zx);
+
+    for (int y = minY; y <= maxY; ++y) {
+        float py = y + 0.5f;
+        __m128 row0 = _mm_set1_ps(B0 * py + C0);
+        __m128 row1 = _mm_set1_ps(B1 * py + C1);
+        __m128 row2 = _mm_set1_ps(B2 * py + C2);
+        __m128 rowZ = _mm_set1_ps(Zy * py + Z0);
+        float* line = &depth_[y * BUFFER_WIDTH];
+
+        for (int x = minX; x <= maxX; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), row0);
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), row1);
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), row2);
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+            if (_mm_movemask_ps(inside) == 0) continue;
+
+            __m128 z = _mm_add_ps(_mm_mul_ps(zx, px), rowZ);
+            __m128 current = _mm_loadu_ps(line + x);
+            __m128 closer = _mm_max_ps(current, z);
+            _mm_storeu_ps(line + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, current)));
+        }
+    }
+}
+
+bool SoftwareOcclusionCuller::isOccluded(const glm::vec3& lo, const glm::vec3& hi) const {
+    float minX = (float)BUFFER_WIDTH, minY = (float)BUFFER_HEIGHT, maxX = 0.f, maxY = 0.f;
+    float nearest = 0.f;
+
+    for (int i = 0; i < 8; ++i) {
+        glm::vec3 corner((i & 1) ? hi.x : lo.x, (i & 2) ? hi.y : lo.y, (i & 4) ? hi.z : lo.z);
+        glm::vec4 clip = viewProjection_ * glm::vec4(corner, 1.f);
+        // Crosses the near plane, its screen rect is unbounded
+        if (clip.z < -clip.w) return false;
+
+        ScreenVertex v = toScreen(clip);
+        minX = std::min(minX, v.x);
+        minY = std::min(minY, v.y);
+        maxX = std::max(maxX, v.x);
+        maxY = std::max(maxY, v.y);
+        nearest = std::max(nearest, v.invW);
+    }
+
+    int x0 = (int)std::max(std::floor(minX), 0.f) & ~3;
+    int y0 = (int)std::max(std::floor(minY), 0.f);
+    int x1 = (int)std::min(std::floor(maxX), (float)(BUFFER_WIDTH - 1));
+    int y1 = (int)std::min(std::floor(maxY), (float)(BUFFER_HEIGHT - 1));
+    if (x0 > x1 || y0 > y1) return false;
+
+    // Hidden only if every pixel of the rect holds an occluder strictly closer than the box's nearest corner
+    const __m128 boxDepth = _mm_set1_ps(nearest);
+    for (int y = y0; y <= y1; ++y) {
+        const float* line = &depth_[y * BUFFER_WIDTH];
+        for (int x = x0; x <= x1; x += 4) {
+            if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(line + x), boxDepth)) != 0) return false;
+        }
+    }
+    return true;
+}
\ No newline at end of file
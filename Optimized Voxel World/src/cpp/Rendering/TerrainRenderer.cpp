@@ -1,15 +1,19 @@
 #include "h/Rendering/TerrainRenderer.h"
 #include "h/Rendering/Utility/GLErrorCatcher.h"
 #include "h/Rendering/Utility/WindowConfig.h"
+#include "h/Rendering/Camera.h"
 
 TerrainRenderer::TerrainRenderer() 
     : width(WindowDetails::WindowWidth)
     , height(WindowDetails::WindowHeight)
     , gl_fill(true)
+    , gpuCulling(true)
     , window(nullptr)
     , vertexPool(nullptr)
+    , boundPoolGeneration(0)
     , lightPos(0.0f, 500.f, 0.0f)
     , lightColor(0.9f, 1.f, 0.7f)
+    , visibleChunksChanged(false)
 {
  
 }
@@ -29,6 +33,8 @@ bool TerrainRenderer::initialize() {
 
     terrainShader = Shader("src/res/shaders/Block.shader");
     blockTextureArray = TextureArray({ "blocks/dirt.png", "blocks/grass_top.png", "blocks/grass_side.png", "blocks/stone.png", "blocks/bedrock.png", "blocks/sand.png", "blocks/water.png" }, false);
+
+    if (!chunkCuller.initialize()) return false;
     
     return true;
 }
@@ -54,6 +60,8 @@ void TerrainRenderer::setupVertexAttributes() {
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vertexPool->getEBO());        // expose a getEBO() accessor
     glBindBuffer(GL_DRAW_INDIRECT_BUFFER, vertexPool->getIndirectBuf());
 
+    boundPoolGeneration = vertexPool->getBufferGeneration();
+
     GLCall(glBindVertexArray(0));
 }
 
@@ -75,6 +83,9 @@ void TerrainRenderer::updateShaderUniforms(glm::mat4& view, glm::mat4& projectio
     terrainShader.setVec3("viewPos",viewPos);
     terrainShader.setVec3("lightPos", lightPos);
     terrainShader.setVec3("lightColor", lightColor);
+
+    viewProjection = projection * view;
+    frustumPlanes = Camera::extractFrustumPlanes(viewProjection);
 }
 
 
@@ -83,16 +94,50 @@ void TerrainRenderer::render() {
 
     blockTextureArray.Bind();
 
+    std::lock_guard<std::mutex> lock(renderMtx);
+    if (visibleChunksChanged) {
+        if (visibleFilter) vertexPool->setAllVisible(visibleFilter);
+        else vertexPool->setVisibleChunks(chunksBeingRendered);
+        visibleChunksChanged = false;
+    }
+    vertexPool->beginFrame();
+    if (vertexPool->getBufferGeneration() != boundPoolGeneration) {
+        setupVertexAttributes();    // the pool grew into new buffers
+    }
+
+    if (!gpuCulling) {
+        terrainShader.use();
+        vertexArray.Bind(); // ensure VAO is bound
+        vertexPool->renderIndirect();
+        return;
+    }
+
+    // Last frame's visible set first, then whatever its depth shows to have come into view
+    chunkCuller.cull(*vertexPool, frustumPlanes, viewProjection);
     terrainShader.use();
+    vertexArray.Bind();
+    chunkCuller.draw();
 
-    std::lock_guard<std::mutex> lock(renderMtx);
-    vertexArray.Bind(); // ensure VAO is bound
-    vertexPool->buildIndirectCommands(chunksBeingRendered);
-    vertexPool->renderIndirect();
+    if (chunkCuller.occlusionActive()) {
+        chunkCuller.cullOccluded();
+        terrainShader.use();
+        vertexArray.Bind();
+        chunkCuller.drawDisoccluded();
+    }
+
+    chunkCuller.endFrame();
 }
 
 void TerrainRenderer::updateRenderChunks(std::vector<std::pair<int, int>>& renderChunks) {
     chunksBeingRendered = renderChunks;
+    visibleFilter = nullptr;
+    visibleChunksChanged = true;
+}
+
+void TerrainRenderer::showAllChunks(std::function<bool(const ChunkUtils::ChunkCoordPair&)> filter) {
+    chunksBeingRendered.clear();
+    visibleFilter = std::move(filter);
+    visibleChunksChanged = true;
 }
 
 void TerrainRenderer::setWindowPointer(GLFWwindow* w) {
@@ -108,6 +153,7 @@ void TerrainRenderer::setVertexPoolPointer(VertexPool* vp) {
 void TerrainRenderer::cleanup() {
     vertexArray.destroy();
     terrainShader.deleteProgram();
+    chunkCuller.destroy();
     blockTextureArray.~TextureArray();
 }
 
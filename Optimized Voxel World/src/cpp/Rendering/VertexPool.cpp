@@ -1,199 +1,759 @@
 #include "h/Rendering/VertexPool.h"
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <limits>
 
-VertexPool::VertexPool(size_t totalPoolBytes)
-    : _poolBytes(totalPoolBytes)
+VertexPool::VertexPool(size_t budgetBytes)
+    : _budgetBytes(budgetBytes)
 {
 }
 
 VertexPool::~VertexPool() {
-    if (_mapV) {
-        glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-        glUnmapBuffer(GL_ARRAY_BUFFER);
-    }
-    if (_mapI) {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
-        glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+    if (_mapStaging) {
+        glUnmapNamedBuffer(_stagingBuf);
     }
+    for (auto& f : _fences) glDeleteSync(f.second);
     glDeleteBuffers(1, &_vbo);
     glDeleteBuffers(1, &_ebo);
     glDeleteBuffers(1, &_indirectBuf);
+    glDeleteBuffers(1, &_boundsBuf);
+    glDeleteBuffers(1, &_scratchBuf);
+    glDeleteBuffers(1, &_stagingBuf);
 }
 
 bool VertexPool::initialize() {
-    // reserve 80% of bytes for verts, 20% for indices
-    _vertRegion = _poolBytes * 4 / 5;
-    _idxRegion = _poolBytes - _vertRegion;
+    // Start with a few pages in the usual 80/20 vertex/index proportion, each region grows on its own from there
+    _vertRegion = std::min(PAGE_BYTES * 4, _budgetBytes * 4 / 5);
+    _idxRegion = std::min(PAGE_BYTES, _budgetBytes - _vertRegion);
 
+    // The pool is only written by GPU copies, dynamic storage is kept for meshes too large for the staging ring
     glGenBuffers(1, &_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-    glBufferStorage(GL_ARRAY_BUFFER, _vertRegion, nullptr,
-        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
-    _mapV = glMapBufferRange(
-        GL_ARRAY_BUFFER, 0, _vertRegion,
-        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT
-    );
-    if (!_mapV) {
-        std::cerr << "VertexPool ERROR: failed to map VBO\n";
-        return false;
-    }
+    glBufferStorage(GL_ARRAY_BUFFER, _vertRegion, nullptr, GL_DYNAMIC_STORAGE_BIT);
 
     glGenBuffers(1, &_ebo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
-    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, _idxRegion, nullptr,
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, _idxRegion, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+    glGenBuffers(1, &_stagingBuf);
+    glBindBuffer(GL_COPY_READ_BUFFER, _stagingBuf);
+    glBufferStorage(GL_COPY_READ_BUFFER, STAGING_BYTES, nullptr,
         GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
-    _mapI = glMapBufferRange(
-        GL_ELEMENT_ARRAY_BUFFER, 0, _idxRegion,
+    _mapStaging = glMapBufferRange(
+        GL_COPY_READ_BUFFER, 0, STAGING_BYTES,
         GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT
     );
-    if (!_mapI) {
-        std::cerr << "VertexPool ERROR: failed to map EBO\n";
+    if (!_mapStaging) {
+        std::cerr << "VertexPool ERROR: failed to map staging ring\n";
         return false;
     }
 
+    // Grows with the number of buckets, see flushCommands
+    _slotCapacity = 4096;
     glGenBuffers(1, &_indirectBuf);
     glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBuf);
-    glBufferData(GL_DRAW_INDIRECT_BUFFER,
-        sizeof(DrawElementsIndirectCommand) * 16384,
-        nullptr, GL_DYNAMIC_DRAW);
+    glBufferStorage(GL_DRAW_INDIRECT_BUFFER,
+        sizeof(DrawElementsIndirectCommand) * _slotCapacity,
+        nullptr, GL_DYNAMIC_STORAGE_BIT);
 
-    _freeV.emplace_back(0, _vertRegion);
-    _freeI.emplace_back(0, _idxRegion);
+    glCreateBuffers(1, &_boundsBuf);
+    glNamedBufferStorage(_boundsBuf, sizeof(SlotBounds) * _slotCapacity, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+    _freeV[0] = _vertRegion;
+    _freeI[0] = _idxRegion;
+    _releasedTailV = _vertRegion;
+    _releasedTailI = _idxRegion;
 
     return true;
 }
 
-bool VertexPool::allocateBucket(const ChunkUtils::ChunkCoordPair& key,
-    size_t vertexBytes,
-    size_t indexCount)
+size_t VertexPool::allocateRange(FreeList& freeList, size_t bytes) {
+    if (bytes == 0) return 0;
+
+    // First fit from the lowest offset keeps live data packed toward the start
+    for (auto it = freeList.begin(); it != freeList.end(); ++it) {
+        if (it->second >= bytes) {
+            size_t offset = it->first;
+            size_t remaining = it->second - bytes;
+            freeList.erase(it);
+            if (remaining > 0) freeList[offset + bytes] = remaining;
+            return offset;
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+void VertexPool::releaseRange(FreeList& freeList, size_t offset, size_t bytes) {
+    if (bytes == 0) return;
+
+    auto next = freeList.lower_bound(offset);
+    if (next != freeList.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            bytes += prev->second;
+            freeList.erase(prev);
+        }
+    }
+    if (next != freeList.end() && offset + bytes == next->first) {
+        bytes += next->second;
+        freeList.erase(next);
+    }
+
+    freeList[offset] = bytes;
+}
+
+size_t VertexPool::highWater(const FreeList& freeList, size_t regionBytes) {
+    if (freeList.empty()) return regionBytes;
+    auto last = std::prev(freeList.end());
+    return (last->first + last->second == regionBytes) ? last->first : regionBytes;
+}
+
+size_t VertexPool::withSlack(size_t bytes, size_t granule) {
+    if (bytes == 0) return 0;
+    // 25% headroom so block edits rarely outgrow the bucket, rounded up to the granule
+    size_t padded = bytes + bytes / 4;
+    return ((padded + granule - 1) / granule) * granule;
+}
+
+size_t VertexPool::eventsInLastMinute(std::deque<std::chrono::steady_clock::time_point>& events) {
+    auto cutoff = std::chrono::steady_clock::now() - std::chrono::minutes(1);
+    while (!events.empty() && events.front() < cutoff) events.pop_front();
+    return events.size();
+}
+
+void VertexPool::uploadBucket(const ChunkUtils::ChunkCoordPair& key,
+    int lod,
+    std::vector<Vertex>&& vertices,
+    std::vector<GLuint>&& indices)
 {
-    size_t neededVb = vertexBytes;
-    size_t vb = ((neededVb + sizeof(Vertex) - 1)
-        / sizeof(Vertex))
-        * sizeof(Vertex);
-
-    size_t neededIb = indexCount * sizeof(GLuint);
-    size_t ib = ((neededIb + sizeof(GLuint) - 1)
-        / sizeof(GLuint))
-        * sizeof(GLuint);
-
-    size_t offV = SIZE_MAX, offI = SIZE_MAX;
-
-    for (auto it = _freeV.begin(); it != _freeV.end(); ++it) {
-        if (it->second >= vb) {
-            offV = it->first;
-            if (it->second > vb) {
-                *it = { it->first + vb, it->second - vb };
-            }
-            else {
-                _freeV.erase(it);
-            }
-            break;
+    _pendingUploads.push({ key, lod, std::move(vertices), std::move(indices), false });
+}
+
+void VertexPool::setBudget(size_t budgetBytes) {
+    std::lock_guard<std::mutex> lock(_bucketMtx);
+    _budgetBytes = budgetBytes;
+}
+
+void VertexPool::setEvictionOrigin(const ChunkUtils::ChunkCoordPair& origin) {
+    std::lock_guard<std::mutex> lock(_bucketMtx);
+    _evictionOrigin = origin;
+}
+
+std::vector<ChunkUtils::ChunkCoordPair> VertexPool::takeEvicted() {
+    std::lock_guard<std::mutex> lock(_bucketMtx);
+    std::vector<ChunkUtils::ChunkCoordPair> evicted;
+    evicted.swap(_evicted);
+    return evicted;
+}
+
+std::vector<ChunkUtils::ChunkCoordPair> VertexPool::takeUploaded() {
+    std::lock_guard<std::mutex> lock(_bucketMtx);
+    std::vector<ChunkUtils::ChunkCoordPair> uploaded;
+    uploaded.swap(_uploaded);
+    return uploaded;
+}
+
+size_t VertexPool::allocateStaging(size_t bytes) {
+    bytes = (bytes + 15) & ~size_t(15);
+
+    // Never split an upload across the end of the ring, skip to the start instead
+    size_t pad = (_stagingHead + bytes > STAGING_BYTES) ? STAGING_BYTES - _stagingHead : 0;
+    if (_stagingUsed + pad + bytes > STAGING_BYTES) return SIZE_MAX;
+
+    if (pad) _stagingHead = 0;
+    size_t offset = _stagingHead;
+    _stagingHead += bytes;
+    _stagingUsed += pad + bytes;
+    _stagingThisFrame += pad + bytes;
+    return offset;
+}
+
+void VertexPool::flushUploads() {
+    auto start = std::chrono::steady_clock::now();
+
+    _pendingUploads.drain([this](PendingUpload&& upload) {
+        if (!upload.release) {
+            _waitingUploads[upload.key] = std::move(upload);
+            return;
+        }
+        // Drop a waiting mesh too, otherwise it would resurrect the bucket on a later flush
+        _waitingUploads.erase(upload.key);
+        auto it = _buckets.find(upload.key);
+        if (it != _buckets.end()) releaseBucket(it);
+    });
+
+    _uploadedLastFrame = 0;
+    _uploadsLastFrame = 0;
+    if (_waitingUploads.empty()) return;
+
+    // A burst of finished meshes is spread over several frames, the chunks nearest the camera go first
+    std::vector<std::pair<int64_t, ChunkUtils::ChunkCoordPair>> order;
+    order.reserve(_waitingUploads.size());
+    for (const auto& kv : _waitingUploads) {
+        int64_t dx = kv.first.first - _evictionOrigin.first;
+        int64_t dz = kv.first.second - _evictionOrigin.second;
+        order.emplace_back(dx * dx + dz * dz, kv.first);
+    }
+    std::sort(order.begin(), order.end());
+
+    size_t attempts = 0;
+    for (const auto& entry : order) {
+        // Meshes waiting on space still cost time, only the bytes actually copied count against the byte budget
+        if (attempts++ > 0) {
+            double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (_uploadedLastFrame >= _uploadBudgetBytes || elapsedMs >= _uploadBudgetMs) break;
         }
+
+        auto it = _waitingUploads.find(entry.second);
+        if (it == _waitingUploads.end()) continue;  // evicted to make room for a nearer mesh
+        const PendingUpload& upload = it->second;
+        size_t bytes = upload.vertices.size() * sizeof(Vertex) + upload.indices.size() * sizeof(GLuint);
+        FlushResult result = flushUpload(upload);
+        if (result == FlushResult::StagingFull) break;  // nothing else fits until older frames retire
+        // A large mesh waiting on the compactor mustn't hold up the smaller ones behind it
+        if (result == FlushResult::WaitingForSpace) continue;
+
+        _uploadedLastFrame += bytes;
+        ++_uploadsLastFrame;
+        _waitingUploads.erase(it);
     }
+}
 
-    for (auto it = _freeI.begin(); it != _freeI.end(); ++it) {
-        if (it->second >= ib) {
-            offI = it->first;
-            if (it->second > ib) {
-                *it = { it->first + ib, it->second - ib };
-            }
-            else {
-                _freeI.erase(it);
+VertexPool::FlushResult VertexPool::flushUpload(const PendingUpload& upload) {
+    const ChunkUtils::ChunkCoordPair& key = upload.key;
+    size_t vb = upload.vertices.size() * sizeof(Vertex);
+    size_t indexCount = upload.indices.size();
+    size_t ib = indexCount * sizeof(GLuint);
+
+    auto it = _buckets.find(key);
+    bool inPlace = false;
+    // The old detail level stays drawn until the slot is rewritten below, so a LOD change never leaves a hole
+    bool lodSwap = it != _buckets.end() && it->second.lod != upload.lod;
+    if (it != _buckets.end()) {
+        const BucketInfo& b = it->second;
+        bool fits = vb <= b.vertexCapacityBytes && indexCount <= b.indexCapacity;
+        // Don't keep a bucket that is now mostly slack, e.g. after dropping to a coarser LOD
+        bool oversized = b.vertexCapacityBytes > 4 * withSlack(vb, VERTEX_GRANULE);
+        inPlace = fits && !oversized;
+    }
+
+    size_t capV = 0, capI = 0, offV = 0, offI = 0;
+    if (inPlace) {
+        offV = it->second.vertexOffsetBytes;
+        offI = it->second.indexOffsetBytes;
+    }
+    else {
+        capV = withSlack(vb, VERTEX_GRANULE);
+        capI = withSlack(ib, INDEX_GRANULE);
+        offV = allocateOrGrow(true, capV);
+        offI = allocateOrGrow(false, capI);
+
+        if (offV == SIZE_MAX || offI == SIZE_MAX) {
+            if (offV != SIZE_MAX) releaseRange(_freeV, offV, capV);
+            if (offI != SIZE_MAX) releaseRange(_freeI, offI, capI);
+
+            // At the budget: wait for evicted, retired or fragmented space to come back, or give this mesh up for now
+            if (makeRoom(upload, capV, capI, offV == SIZE_MAX, offI == SIZE_MAX)) return FlushResult::WaitingForSpace;
+            // A relocation or LOD swap gives up its old mesh as well, it would otherwise stay drawn at a level the
+            // neighbours no longer match until the chunk is meshed again
+            if (it != _buckets.end()) releaseBucket(it);
+            _evicted.push_back(key);
+            _evictionEvents.push_back(std::chrono::steady_clock::now());
+            return FlushResult::Done;
+        }
+    }
+
+    size_t stagedIndices = (vb + 15) & ~size_t(15);
+    if (stagedIndices + ib <= STAGING_BYTES) {
+        size_t staged = allocateStaging(stagedIndices + ib);
+        if (staged == SIZE_MAX) {
+            if (!inPlace) {
+                releaseRange(_freeV, offV, capV);
+                releaseRange(_freeI, offI, capI);
             }
-            break;
+            return FlushResult::StagingFull;
         }
+
+        // The copies are ordered after every draw already submitted, so in-place overwrites never race the GPU
+        char* ring = (char*)_mapStaging + staged;
+        if (vb) std::memcpy(ring, upload.vertices.data(), vb);
+        if (ib) std::memcpy(ring + stagedIndices, upload.indices.data(), ib);
+        if (vb) glCopyNamedBufferSubData(_stagingBuf, _vbo, staged, offV, vb);
+        if (ib) glCopyNamedBufferSubData(_stagingBuf, _ebo, staged + stagedIndices, offI, ib);
+    }
+    else {
+        // Larger than the whole ring, let the driver stage it
+        if (vb) glNamedBufferSubData(_vbo, offV, vb, upload.vertices.data());
+        if (ib) glNamedBufferSubData(_ebo, offI, ib, upload.indices.data());
     }
 
-    if (offV == SIZE_MAX || offI == SIZE_MAX) {
-        std::cerr << "VertexPool ERROR: out of "
-            << (offV == SIZE_MAX ? "vertex" : "")
-            << ((offV == SIZE_MAX && offI == SIZE_MAX) ? " & " : "")
-            << (offI == SIZE_MAX ? "index" : "")
-            << " space for chunk (" << key.first
-            << "," << key.second << ")\n";
-        return false;
+    glm::vec3 lo(std::numeric_limits<float>::max()), hi(std::numeric_limits<float>::lowest());
+    for (const Vertex& v : upload.vertices) {
+        lo = glm::min(lo, v.position);
+        hi = glm::max(hi, v.position);
+    }
+    SlotBounds bounds = { glm::vec4(lo, 0.f), glm::vec4(hi, 0.f) };
+
+    if (inPlace) {
+        _bounds[it->second.slot] = bounds;
+        it->second.vertexSizeBytes = vb;
+        it->second.indexCount = indexCount;
+        it->second.lod = upload.lod;
+        writeSlot(it->second);
+        _inPlaceEvents.push_back(std::chrono::steady_clock::now());
+        if (lodSwap) _lodSwapEvents.push_back(_inPlaceEvents.back());
+        _uploaded.push_back(key);
+        return FlushResult::Done;
+    }
+
+    // A relocated bucket keeps its draw slot, only the command is rewritten
+    GLuint slot;
+    if (it != _buckets.end()) {
+        slot = it->second.slot;
+        retireBucketRanges(it->second);
+        _relocationEvents.push_back(std::chrono::steady_clock::now());
+        if (lodSwap) _lodSwapEvents.push_back(_relocationEvents.back());
+    }
+    else {
+        slot = allocateSlot();
+        _commands[slot].instanceCount = (_visibleFilter ? _visibleFilter(key) : _visible.count(key) != 0) ? 1 : 0;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(_bucketMtx);
-        _buckets[key] = {offV, vb, offI, indexCount};
+    _bounds[slot] = bounds;
+
+    BucketInfo& b = _buckets[key];
+    b = { offV, vb, capV, offI, indexCount, capI / sizeof(GLuint), upload.lod, slot };
+    if (capV) _liveV[offV] = key;
+    if (capI) _liveI[offI] = key;
+    writeSlot(b);
+    _uploaded.push_back(key);
+
+    return FlushResult::Done;
+}
+
+void VertexPool::freeBucket(const ChunkUtils::ChunkCoordPair& key) {
+    // Through the same queue as uploads so it lands after any mesh for this chunk that was queued before it
+    _pendingUploads.push({ key, 0, {}, {}, true });
+}
+
+void VertexPool::retireBucketRanges(const BucketInfo& b) {
+    if (b.vertexCapacityBytes) _liveV.erase(b.vertexOffsetBytes);
+    if (b.indexCapacity) _liveI.erase(b.indexOffsetBytes);
+    retireRange(b.vertexOffsetBytes, b.vertexCapacityBytes, true);
+    retireRange(b.indexOffsetBytes, b.indexCapacity * sizeof(GLuint), false);
+}
+
+void VertexPool::releaseBucket(std::unordered_map<ChunkUtils::ChunkCoordPair, BucketInfo, ChunkUtils::PairHash>::iterator it) {
+    retireBucketRanges(it->second);
+    releaseSlot(it->second.slot);
+    _buckets.erase(it);
+}
+
+GLuint VertexPool::allocateSlot() {
+    // Lowest free slot first so the draw range stays dense
+    GLuint slot;
+    if (!_freeSlots.empty()) {
+        slot = *_freeSlots.begin();
+        _freeSlots.erase(_freeSlots.begin());
+    }
+    else {
+        slot = _slotHigh++;
+    }
+
+    if (slot >= _commands.size()) {
+        _commands.resize(slot + 1, {});
+        _bounds.resize(slot + 1, {});
+        _slotDirty.resize(slot + 1, false);
+    }
+    return slot;
+}
+
+void VertexPool::releaseSlot(GLuint slot) {
+    _commands[slot] = {};
+    markSlotDirty(slot);
+
+    _freeSlots.insert(slot);
+    while (!_freeSlots.empty() && *_freeSlots.rbegin() == _slotHigh - 1) {
+        _freeSlots.erase(std::prev(_freeSlots.end()));
+        --_slotHigh;
+    }
+}
+
+void VertexPool::markSlotDirty(GLuint slot) {
+    if (_slotDirty[slot]) return;
+    _slotDirty[slot] = true;
+    _dirtySlots.push_back(slot);
+}
+
+void VertexPool::writeSlot(const BucketInfo& b) {
+    DrawElementsIndirectCommand& cmd = _commands[b.slot];
+    cmd.count = (GLuint)b.indexCount;
+    cmd.firstIndex = (GLuint)(b.indexOffsetBytes / sizeof(GLuint));
+    cmd.baseVertex = (GLint)(b.vertexOffsetBytes / sizeof(Vertex));
+    cmd.baseInstance = 0;
+    markSlotDirty(b.slot);
+}
+
+void VertexPool::uploadSlotRun(GLuint buffer, const void* data, size_t offset, size_t bytes) {
+    size_t staged = allocateStaging(bytes);
+    if (staged != SIZE_MAX) {
+        std::memcpy((char*)_mapStaging + staged, data, bytes);
+        glCopyNamedBufferSubData(_stagingBuf, buffer, staged, offset, bytes);
+    }
+    else {
+        glNamedBufferSubData(buffer, offset, bytes, data);
+    }
+}
+
+void VertexPool::flushCommands() {
+    _commandUploads = _dirtySlots.size();
+    if (_dirtySlots.empty()) return;
+
+    if (_commands.size() > _slotCapacity) {
+        size_t grown = std::max(_commands.size(), _slotCapacity * 2);
+        GLuint grownBuffer = 0;
+        glCreateBuffers(1, &grownBuffer);
+        glNamedBufferStorage(grownBuffer, grown * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_STORAGE_BIT);
+        glCopyNamedBufferSubData(_indirectBuf, grownBuffer, 0, 0, _slotCapacity * sizeof(DrawElementsIndirectCommand));
+        glDeleteBuffers(1, &_indirectBuf);
+        _indirectBuf = grownBuffer;
+
+        glCreateBuffers(1, &grownBuffer);
+        glNamedBufferStorage(grownBuffer, grown * sizeof(SlotBounds), nullptr, GL_DYNAMIC_STORAGE_BIT);
+        glCopyNamedBufferSubData(_boundsBuf, grownBuffer, 0, 0, _slotCapacity * sizeof(SlotBounds));
+        glDeleteBuffers(1, &_boundsBuf);
+        _boundsBuf = grownBuffer;
+
+        _slotCapacity = grown;
+    }
+
+    // Copy each run of consecutive dirty slots in one go
+    std::sort(_dirtySlots.begin(), _dirtySlots.end());
+    for (size_t i = 0; i < _dirtySlots.size();) {
+        size_t j = i + 1;
+        while (j < _dirtySlots.size() && _dirtySlots[j] == _dirtySlots[j - 1] + 1) ++j;
+
+        GLuint first = _dirtySlots[i];
+        uploadSlotRun(_indirectBuf, &_commands[first], first * sizeof(DrawElementsIndirectCommand), (j - i) * sizeof(DrawElementsIndirectCommand));
+        uploadSlotRun(_boundsBuf, &_bounds[first], first * sizeof(SlotBounds), (j - i) * sizeof(SlotBounds));
+        i = j;
+    }
+
+    for (GLuint slot : _dirtySlots) _slotDirty[slot] = false;
+    _dirtySlots.clear();
+}
+
+size_t VertexPool::allocateOrGrow(bool vertex, size_t bytes) {
+    FreeList& freeList = vertex ? _freeV : _freeI;
+    size_t offset = allocateRange(freeList, bytes);
+    if (offset == SIZE_MAX && growRegion(vertex, bytes)) {
+        offset = allocateRange(freeList, bytes);
+    }
+    return offset;
+}
+
+bool VertexPool::growRegion(bool vertex, size_t bytes) {
+    FreeList& freeList = vertex ? _freeV : _freeI;
+    size_t& region = vertex ? _vertRegion : _idxRegion;
+    size_t other = vertex ? _idxRegion : _vertRegion;
+    GLuint& buffer = vertex ? _vbo : _ebo;
+
+    // A free tail is extended, otherwise the allocation lands after the current end
+    size_t base = highWater(freeList, region);
+    size_t needed = base + bytes;
+    size_t grown = std::max(region + PAGE_BYTES, (needed + PAGE_BYTES - 1) / PAGE_BYTES * PAGE_BYTES);
+    if (grown + other > _budgetBytes) grown = _budgetBytes > other ? _budgetBytes - other : 0;
+    if (grown < needed) return false;
+
+    // The copy is ordered after everything already issued against the old buffer,
+    // and GL keeps the old storage alive until the frames still drawing from it finish
+    GLuint grownBuffer = 0;
+    glCreateBuffers(1, &grownBuffer);
+    glNamedBufferStorage(grownBuffer, grown, nullptr, GL_DYNAMIC_STORAGE_BIT);
+    if (base) glCopyNamedBufferSubData(buffer, grownBuffer, 0, 0, base);
+    glDeleteBuffers(1, &buffer);
+    buffer = grownBuffer;
+
+    releaseRange(freeList, region, grown - region);
+    (vertex ? _releasedTailV : _releasedTailI) = base;
+    region = grown;
+    ++_bufferGeneration;
+
+    return true;
+}
+
+bool VertexPool::evictsBefore(const ChunkUtils::ChunkCoordPair& a, int lodA, const ChunkUtils::ChunkCoordPair& b, int lodB) const {
+    if (lodA != lodB) return lodA > lodB;
+
+    auto distanceSq = [this](const ChunkUtils::ChunkCoordPair& c) {
+        int64_t dx = c.first - _evictionOrigin.first;
+        int64_t dz = c.second - _evictionOrigin.second;
+        return dx * dx + dz * dz;
+    };
+    return distanceSq(a) > distanceSq(b);
+}
+
+bool VertexPool::makeRoom(const PendingUpload& upload, size_t vertexBytes, size_t indexBytes, bool needVertex, bool needIndex) {
+    // Space that comes back without evicting anything: scattered free ranges the compactor will gather and retired ranges
+    size_t reclaimV = 0, reclaimI = 0;
+    for (const auto& f : _freeV) reclaimV += f.second;
+    for (const auto& f : _freeI) reclaimI += f.second;
+    for (const auto& r : _retired) (r.vertex ? reclaimV : reclaimI) += r.size;
+
+    auto enough = [&]() {
+        return (!needVertex || reclaimV >= vertexBytes) && (!needIndex || reclaimI >= indexBytes);
+    };
+    if (enough()) return true;
+
+    // Highest LOD and farthest first, and never a mesh that matters more than the one being placed
+    std::vector<std::pair<ChunkUtils::ChunkCoordPair, int>> candidates;
+    for (const auto& kv : _buckets) {
+        if (kv.first != upload.key && evictsBefore(kv.first, kv.second.lod, upload.key, upload.lod)) {
+            candidates.emplace_back(kv.first, kv.second.lod);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [this](const auto& a, const auto& b) {
+        return evictsBefore(a.first, a.second, b.first, b.second);
+    });
+
+    size_t victims = 0;
+    while (victims < candidates.size() && !enough()) {
+        const BucketInfo& b = _buckets[candidates[victims].first];
+        reclaimV += b.vertexCapacityBytes;
+        reclaimI += b.indexCapacity * sizeof(GLuint);
+        ++victims;
+    }
+    if (!enough()) return false;    // evicting everything allowed still wouldn't fit, so evict nothing
+
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < victims; ++i) {
+        releaseBucket(_buckets.find(candidates[i].first));
+        // A newer mesh still waiting would bring the bucket back on a later flush while the chunk is queued to remesh
+        _waitingUploads.erase(candidates[i].first);
+        _evicted.push_back(candidates[i].first);
+        _evictionEvents.push_back(now);
     }
 
     return true;
 }
 
-void VertexPool::updateVertices(const ChunkUtils::ChunkCoordPair& key, const void* data, size_t bytes) {
+bool VertexPool::containsBucket(const ChunkUtils::ChunkCoordPair& key) const {
     std::lock_guard<std::mutex> lock(_bucketMtx);
-    auto it = _buckets.find(key);
-    if (it == _buckets.end() || bytes > it->second.vertexSizeBytes) return;
-    std::memcpy((char*)_mapV + it->second.vertexOffsetBytes, data, bytes);
+    return _buckets.count(key) != 0;
 }
 
-void VertexPool::updateIndices(const ChunkUtils::ChunkCoordPair& key, const GLuint* data, size_t count) {
+size_t VertexPool::bucketBytes(const ChunkUtils::ChunkCoordPair& key, int* lod) const {
     std::lock_guard<std::mutex> lock(_bucketMtx);
     auto it = _buckets.find(key);
-    if (it == _buckets.end()) {
-        std::cerr << "VertexPool ERROR: updateIndices missing bucket for ("
-            << key.first << "," << key.second << ")\n";
-        return;
+    if (it == _buckets.end()) return 0;
+    if (lod) *lod = it->second.lod;
+    return it->second.vertexCapacityBytes + it->second.indexCapacity * sizeof(GLuint);
+}
+
+void VertexPool::retireRange(size_t offset, size_t bytes, bool vertex) {
+    // Called with _bucketMtx held. Frames still in flight may draw from this range and pending copies may touch it,
+    // so it only returns to the free list once the next fence beginFrame inserts has signalled.
+    if (bytes == 0) return;
+    _retired.push_back({ offset, bytes, vertex, _fenceIndex });
+}
+
+void VertexPool::reclaimRetired() {
+    while (!_fences.empty()) {
+        GLenum status = glClientWaitSync(_fences.front().second, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+        _completedFence = _fences.front().first;
+        glDeleteSync(_fences.front().second);
+        _fences.pop_front();
     }
-    if (count > it->second.indexCount) {
-        std::cerr << "VertexPool ERROR: index count " << count
-            << " exceeds allocated " << it->second.indexCount
-            << " for chunk (" << key.first << "," << key.second << ")\n";
-        return;
+
+    while (!_retired.empty() && _retired.front().fenceIndex <= _completedFence) {
+        const auto& r = _retired.front();
+        releaseRange(r.vertex ? _freeV : _freeI, r.offset, r.size);
+        _retired.pop_front();
+    }
+
+    while (!_stagingInFlight.empty() && _stagingInFlight.front().first <= _completedFence) {
+        _stagingUsed -= _stagingInFlight.front().second;
+        _stagingInFlight.pop_front();
     }
-    std::memcpy((char*)_mapI + it->second.indexOffsetBytes,
-        data, count * sizeof(GLuint));
 }
 
-void VertexPool::freeBucket(const ChunkUtils::ChunkCoordPair& key) {
+void VertexPool::beginFrame() {
     std::lock_guard<std::mutex> lock(_bucketMtx);
-    auto it = _buckets.find(key);
-    if (it == _buckets.end()) return;
-    const auto& b = it->second;
-    _freeV.emplace_back(b.vertexOffsetBytes, b.vertexSizeBytes);
-    _freeI.emplace_back(b.indexOffsetBytes, b.indexCount * sizeof(GLuint));
-    _buckets.erase(it);
+
+    reclaimRetired();
+    flushUploads();
+
+    size_t moved = compactRegion(true, _compactionBudget);
+    moved += compactRegion(false, _compactionBudget > moved ? _compactionBudget - moved : 0);
+    _compactedLastFrame = moved;
+
+    releaseTail(true);
+    releaseTail(false);
+
+    flushCommands();
+
+    _stagingInFlight.emplace_back(_fenceIndex, _stagingThisFrame);
+    _stagingThisFrame = 0;
+    _fences.emplace_back(_fenceIndex++, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
 }
 
-bool VertexPool::containsBucket(const ChunkUtils::ChunkCoordPair& key) const {
+size_t VertexPool::compactRegion(bool vertex, size_t budget) {
+    FreeList& freeList = vertex ? _freeV : _freeI;
+    LiveList& live = vertex ? _liveV : _liveI;
+    GLuint buffer = vertex ? _vbo : _ebo;
+
+    size_t moved = 0;
+    while (moved < budget && !freeList.empty()) {
+        // Fill the lowest hole with the first live bucket above it
+        auto hole = freeList.begin();
+        auto owner = live.lower_bound(hole->first);
+        if (owner == live.end()) break;     // everything above the hole is free tail
+
+        BucketInfo& b = _buckets[owner->second];
+        size_t src = owner->first;
+        size_t dst = hole->first;
+        size_t holeBytes = hole->second;
+        size_t bytes = vertex ? b.vertexCapacityBytes : b.indexCapacity * sizeof(GLuint);
+        size_t used = vertex ? b.vertexSizeBytes : b.indexCount * sizeof(GLuint);
+
+        // A retired range still separates them; it coalesces with the hole once reclaimed
+        if (dst + holeBytes != src && holeBytes < bytes) break;
+        if (moved > 0 && moved + used > budget) break;
+
+        freeList.erase(hole);
+        if (holeBytes > bytes) releaseRange(freeList, dst + bytes, holeBytes - bytes);
+
+        // Only the used part of the bucket carries data, the slack moves for free
+        moveRange(buffer, src, dst, used);
+
+        if (vertex) b.vertexOffsetBytes = dst;
+        else b.indexOffsetBytes = dst;
+        ChunkUtils::ChunkCoordPair key = owner->second;
+        live.erase(owner);
+        live[dst] = key;
+        writeSlot(b);
+
+        // When sliding into a smaller adjacent hole only the top of the old range is vacated
+        size_t vacated = std::max(src, dst + bytes);
+        retireRange(vacated, src + bytes - vacated, vertex);
+
+        moved += used;
+    }
+
+    return moved;
+}
+
+void VertexPool::moveRange(GLuint buffer, size_t src, size_t dst, size_t bytes) {
+    if (dst + bytes <= src) {
+        glCopyNamedBufferSubData(buffer, buffer, src, dst, bytes);
+        return;
+    }
+
+    // Overlapping copies within one buffer are illegal, bounce through a scratch buffer
+    if (_scratchBytes < bytes) {
+        glDeleteBuffers(1, &_scratchBuf);
+        _scratchBytes = std::max(bytes, _scratchBytes * 2);
+        glCreateBuffers(1, &_scratchBuf);
+        glNamedBufferStorage(_scratchBuf, _scratchBytes, nullptr, 0);
+    }
+    glCopyNamedBufferSubData(buffer, _scratchBuf, src, 0, bytes);
+    glCopyNamedBufferSubData(_scratchBuf, buffer, 0, dst, bytes);
+}
+
+void VertexPool::releaseTail(bool vertex) {
+    const FreeList& freeList = vertex ? _freeV : _freeI;
+    size_t region = vertex ? _vertRegion : _idxRegion;
+    size_t& released = vertex ? _releasedTailV : _releasedTailI;
+
+    // Let the driver drop the backing of the free tail whenever compaction has grown it
+    size_t tail = highWater(freeList, region);
+    if (tail < released) {
+        glInvalidateBufferSubData(vertex ? _vbo : _ebo, tail, region - tail);
+    }
+    released = tail;
+}
+
+VertexPoolStats VertexPool::getStats() const {
     std::lock_guard<std::mutex> lock(_bucketMtx);
-    return _buckets.count(key) != 0;
+
+    std::array<size_t, ChunkUtils::LOD_COUNT> lodBytes = {};
+    for (const auto& kv : _buckets) {
+        int lod = std::clamp(kv.second.lod, 0, ChunkUtils::LOD_COUNT - 1);
+        lodBytes[lod] += kv.second.vertexCapacityBytes + kv.second.indexCapacity * sizeof(GLuint);
+    }
+
+    return {
+        _budgetBytes,
+        _vertRegion,
+        _idxRegion,
+        highWater(_freeV, _vertRegion),
+        highWater(_freeI, _idxRegion),
+        _compactedLastFrame,
+        eventsInLastMinute(_inPlaceEvents),
+        eventsInLastMinute(_relocationEvents),
+        eventsInLastMinute(_evictionEvents),
+        eventsInLastMinute(_lodSwapEvents),
+        lodBytes,
+        _slotHigh,
+        _commandUploads,
+        _uploadedLastFrame,
+        _uploadsLastFrame,
+        _waitingUploads.size()
+    };
 }
 
-void VertexPool::buildIndirectCommands(const std::vector<ChunkUtils::ChunkCoordPair>& visible) {
-    _commands.clear();
-    for (auto& c : visible) {
-        {
-            std::lock_guard<std::mutex> lock(_bucketMtx);
-            auto it = _buckets.find(c);
-            if (it == _buckets.end()) continue;
-            const auto& b = it->second;
-            DrawElementsIndirectCommand cmd = {};
-            cmd.count = (GLuint)b.indexCount;
-            cmd.instanceCount = 1;
-            cmd.firstIndex = (GLuint)(b.indexOffsetBytes / sizeof(GLuint));
-            cmd.baseVertex = (GLint)(b.vertexOffsetBytes / sizeof(Vertex));
-            cmd.baseInstance = 0;
-            _commands.push_back(cmd);
+void VertexPool::setVisibleChunks(const std::vector<ChunkUtils::ChunkCoordPair>& visibleChunks) {
+    std::lock_guard<std::mutex> lock(_bucketMtx);
+
+    std::unordered_set<ChunkUtils::ChunkCoordPair, ChunkUtils::PairHash> visible(visibleChunks.begin(), visibleChunks.end());
+
+    if (_visibleFilter) {
+        // Coming back from setAllVisible, there is no previous set to diff against
+        _visibleFilter = nullptr;
+        for (const auto& kv : _buckets) setInstances(kv.first, visible.count(kv.first) ? 1 : 0);
+    }
+    else {
+        for (const auto& key : visible) {
+            if (!_visible.count(key)) setInstances(key, 1);
+        }
+        for (const auto& key : _visible) {
+            if (!visible.count(key)) setInstances(key, 0);
         }
     }
-    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBuf);
-    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0,
-        _commands.size() * sizeof(DrawElementsIndirectCommand),
-        _commands.data());
+
+    _visible.swap(visible);
+}
+
+void VertexPool::setAllVisible(std::function<bool(const ChunkUtils::ChunkCoordPair&)> filter) {
+    std::lock_guard<std::mutex> lock(_bucketMtx);
+
+    _visibleFilter = std::move(filter);
+    _visible.clear();
+    for (const auto& kv : _buckets) setInstances(kv.first, _visibleFilter(kv.first) ? 1 : 0);
+}
+
+void VertexPool::setInstances(const ChunkUtils::ChunkCoordPair& key, GLuint instances) {
+    auto it = _buckets.find(key);
+    if (it == _buckets.end()) return;   // picked up from _visible or the filter when its mesh arrives
+    if (_commands[it->second.slot].instanceCount == instances) return;
+    _commands[it->second.slot].instanceCount = instances;
+    markSlotDirty(it->second.slot);
 }
 
 void VertexPool::renderIndirect() const {
-    if (_commands.empty()) return;
+    std::lock_guard<std::mutex> lock(_bucketMtx);
+    if (_slotHigh == 0) return;
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBuf);
     glMultiDrawElementsIndirect(
         GL_TRIANGLES,
         GL_UNSIGNED_INT,
         nullptr,
-        (GLsizei)_commands.size(),
+        (GLsizei)_slotHigh,
         0
     );
 }
\ No newline at end of file
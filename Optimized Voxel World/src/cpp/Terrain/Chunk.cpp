@@ -18,12 +18,26 @@ Chunk::Chunk()
     for (int index = 0; index < 6; index++) neighborOffsets[index] = std::numeric_limits<int>::min();
 }
 
-void Chunk::generateChunk(ProcGen& proceduralGenerator) {
+void Chunk::generateChunk(const ProcGen& proceduralGenerator) {
     chunkLodMap[detailLevel].resize(ChunkUtils::getChunkLength(detailLevel), BlockID::AIR);
     highestOccupiedIndex = proceduralGenerator.generateChunk(chunkLodMap[detailLevel], std::make_pair(chunkX, chunkZ), detailLevel);
     publishSnapshot();
 }
 
+void Chunk::restoreBlocks(std::vector<BlockID>&& blocks) {
+    chunkLodMap[detailLevel] = std::move(blocks);
+    const auto& restored = chunkLodMap[detailLevel];
+
+    highestOccupiedIndex = -1;
+    for (int index = (int)restored.size() - 1; index >= 0; --index) {
+        if (restored[index] != BlockID::AIR) {
+            highestOccupiedIndex = index;
+            break;
+        }
+    }
+    publishSnapshot();
+}
+
 #define CHECK_PERFORMED_MASK(face) (1 << (face * 2))
 #define CHECK_RESULT_MASK(face) (1 << (face * 2 + 1))
 
@@ -0,0 +1,388 @@
+#include "h/Terrain/ChunkDirectory.h"
+#include "h/Terrain/ChunkReclaimer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+namespace {
+	std::atomic<uint64_t> nextDirectoryId{ 1 };
+
+	// Directories still alive, so a thread that exits only hands its reader slots back to those
+	std::mutex registryMtx;
+	std::unordered_set<uint64_t> liveDirectories;
+
+	struct ThreadReaderSlot {
+		uint64_t directory;
+		std::atomic<bool>* claimed;
+		int slot;
+		int depth;
+	};
+
+	struct ThreadReaderSlots {
+		std::vector<ThreadReaderSlot> slots;
+		~ThreadReaderSlots() {
+			std::lock_guard<std::mutex> lock(registryMtx);
+			for (const auto& s : slots) {
+				if (liveDirectories.count(s.directory)) s.claimed->store(false, std::memory_order_release);
+			}
+		}
+	};
+	thread_local ThreadReaderSlots threadSlots;
+
+	ThreadReaderSlot* findThreadSlot(uint64_t directory) {
+		for (auto& s : threadSlots.slots) {
+			if (s.directory == directory) return &s;
+		}
+		return nullptr;
+	}
+
+	size_t capacityFor(size_t chunks) {
+		size_t capacity = 16;
+		while (capacity < chunks * 2) capacity *= 2;
+		return capacity;
+	}
+}
+
+ChunkRef::ChunkRef(const ChunkRef& other)
+	: entry(other.entry)
+{
+	if (entry) entry->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+ChunkRef::~ChunkRef() {
+	if (entry) ChunkDirectory::releaseEntry(entry);
+}
+
+ChunkDirectory::Table::Table(size_t capacity)
+	: mask(capacity - 1)
+	, shift(64)
+	, slots(new Slot[capacity])
+	, used(0)
+{
+	for (size_t c = capacity; c > 1; c >>= 1) --shift;
+	for (size_t i = 0; i < capacity; ++i) {
+		slots[i].key.store(EMPTY, std::memory_order_relaxed);
+		slots[i].entry.store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+ChunkDirectory::ChunkDirectory(ChunkReclaimer* reclaimer)
+	: reclaimer(reclaimer)
+	, table(new Table(16))
+	, live(0)
+	, id(nextDirectoryId.fetch_add(1))
+	, globalEpoch(0)
+{
+	for (auto& reader : readers) {
+		reader.epoch.store(IDLE, std::memory_order_relaxed);
+		reader.claimed.store(false, std::memory_order_relaxed);
+	}
+	std::lock_guard<std::mutex> lock(registryMtx);
+	liveDirectories.insert(id);
+}
+
+ChunkDirectory::~ChunkDirectory() {
+	{
+		std::lock_guard<std::mutex> lock(registryMtx);
+		liveDirectories.erase(id);
+	}
+
+	// No readers are left by now, everything goes at once. Chunks still held through a ChunkRef outlive the directory
+	Table* current = table.load(std::memory_order_relaxed);
+	for (size_t i = 0; i <= current->mask; ++i) {
+		if (ChunkEntry* entry = current->slots[i].entry.load(std::memory_order_relaxed)) releaseEntry(entry);
+	}
+	delete current;
+	for (const auto& r : retiredEntries) releaseEntry(r.item);
+	for (const auto& r : retiredTables) delete r.item;
+}
+
+ChunkDirectory::ReadGuard::ReadGuard(const ChunkDirectory& dir)
+	: directory(dir)
+{
+	ThreadReaderSlot* mine = findThreadSlot(directory.id);
+	if (!mine) {
+		int claimed = directory.claimReaderSlot();
+		threadSlots.slots.push_back({ directory.id, &directory.readers[claimed].claimed, claimed, 0 });
+		mine = &threadSlots.slots.back();
+	}
+	slot = mine->slot;
+
+	if (mine->depth++ == 0) {
+		directory.readers[slot].epoch.store(directory.globalEpoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		// Pairs with the fence in collect: either the writer sees this pin or this read sees the writer's unlink
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+}
+
+ChunkDirectory::ReadGuard::~ReadGuard() {
+	ThreadReaderSlot* mine = findThreadSlot(directory.id);
+	if (--mine->depth == 0) directory.readers[slot].epoch.store(IDLE, std::memory_order_release);
+}
+
+int ChunkDirectory::claimReaderSlot() const {
+	bool warned = false;
+	while (true) {
+		for (int i = 0; i < MAX_READERS; ++i) {
+			bool expected = false;
+			if (!readers[i].claimed.load(std::memory_order_relaxed) && readers[i].claimed.compare_exchange_strong(expected, true)) return i;
+		}
+		if (!warned) {
+			std::cerr << "ChunkDirectory ERROR: more than " << MAX_READERS << " reader threads, waiting for one to exit\n";
+			warned = true;
+		}
+		std::this_thread::yield();
+	}
+}
+
+const ChunkEntry* ChunkDirectory::find(uint64_t key) const {
+	const Table* current = table.load(std::memory_order_acquire);
+	size_t i = home(*current, key);
+	for (size_t probes = 0; probes <= current->mask; ++probes) {
+		uint64_t slotKey = current->slots[i].key.load(std::memory_order_acquire);
+		if (slotKey == EMPTY) return nullptr;
+		if (slotKey == key) {
+			const ChunkEntry* entry = current->slots[i].entry.load(std::memory_order_acquire);
+			// A removed chunk's slot can be handed to another key between the two loads, entries know their own key
+			return (entry && entry->key == key) ? entry : nullptr;
+		}
+		i = (i + 1) & current->mask;
+	}
+	return nullptr;
+}
+
+ChunkRef ChunkDirectory::acquire(const ChunkUtils::ChunkCoordPair& key) const {
+	ReadGuard guard(*this);
+	ChunkEntry* entry = const_cast<ChunkEntry*>(find(pack(key)));
+	if (!entry) return ChunkRef();
+	// Safe inside the epoch, the directory's own reference is only dropped after every current reader has left
+	entry->refs.fetch_add(1, std::memory_order_relaxed);
+	return ChunkRef(entry);
+}
+
+bool ChunkDirectory::contains(const ChunkUtils::ChunkCoordPair& key) const {
+	ReadGuard guard(*this);
+	return find(pack(key)) != nullptr;
+}
+
+void ChunkDirectory::insert(const ChunkUtils::ChunkCoordPair& key, std::unique_ptr<Chunk> chunk) {
+	uint64_t packed = pack(key);
+	ChunkEntry* entry = new ChunkEntry{ packed, std::move(chunk), 1, reclaimer };
+
+	// Removed chunks keep their slot, so the table is rebuilt on slots in use rather than on live chunks
+	Table* current = table.load(std::memory_order_relaxed);
+	if ((current->used + 1) * 5 > (current->mask + 1) * 3) {
+		rebuild(capacityFor(live.load(std::memory_order_relaxed) + 1));
+		current = table.load(std::memory_order_relaxed);
+	}
+
+	size_t i = home(*current, packed);
+	size_t reuse = SIZE_MAX;
+	while (true) {
+		uint64_t slotKey = current->slots[i].key.load(std::memory_order_relaxed);
+		if (slotKey == packed) {
+			ChunkEntry* old = current->slots[i].entry.exchange(entry, std::memory_order_acq_rel);
+			if (old) retireEntry(old);
+			else live.fetch_add(1, std::memory_order_relaxed);
+			collect();
+			return;
+		}
+		if (slotKey == EMPTY) break;
+		if (reuse == SIZE_MAX && !current->slots[i].entry.load(std::memory_order_relaxed)) reuse = i;
+		i = (i + 1) & current->mask;
+	}
+
+	size_t target = reuse != SIZE_MAX ? reuse : i;
+	if (target == i) ++current->used;
+	// Key before entry, a reader that matches the key before the entry lands simply finds nothing yet
+	current->slots[target].key.store(packed, std::memory_order_release);
+	current->slots[target].entry.store(entry, std::memory_order_release);
+	live.fetch_add(1, std::memory_order_relaxed);
+	collect();
+}
+
+bool ChunkDirectory::erase(const ChunkUtils::ChunkCoordPair& key) {
+	uint64_t packed = pack(key);
+	Table* current = table.load(std::memory_order_relaxed);
+	size_t i = home(*current, packed);
+	for (size_t probes = 0; probes <= current->mask; ++probes) {
+		uint64_t slotKey = current->slots[i].key.load(std::memory_order_relaxed);
+		if (slotKey == EMPTY) return false;
+		if (slotKey == packed) {
+			ChunkEntry* old = current->slots[i].entry.exchange(nullptr, std::memory_order_acq_rel);
+			if (!old) return false;
+			live.fetch_sub(1, std::memory_order_relaxed);
+			retireEntry(old);
+			collect();
+			return true;
+		}
+		i = (i + 1) & current->mask;
+	}
+	return false;
+}
+
+void ChunkDirectory::clear() {
+	Table* old = table.exchange(new Table(16), std::memory_order_acq_rel);
+	uint64_t epoch = globalEpoch.load(std::memory_order_relaxed);
+	for (size_t i = 0; i <= old->mask; ++i) {
+		if (ChunkEntry* entry = old->slots[i].entry.load(std::memory_order_relaxed)) retiredEntries.push_back({ epoch, entry });
+	}
+	retiredTables.push_back({ epoch, old });
+	live.store(0, std::memory_order_relaxed);
+	collect();
+}
+
+std::vector<ChunkUtils::ChunkCoordPair> ChunkDirectory::keys() const {
+	std::vector<ChunkUtils::ChunkCoordPair> result;
+	const Table* current = table.load(std::memory_order_relaxed);
+	result.reserve(live.load(std::memory_order_relaxed));
+	for (size_t i = 0; i <= current->mask; ++i) {
+		if (current->slots[i].entry.load(std::memory_order_relaxed)) result.push_back(unpack(current->slots[i].key.load(std::memory_order_relaxed)));
+	}
+	return result;
+}
+
+void ChunkDirectory::rebuild(size_t capacity) {
+	Table* old = table.load(std::memory_order_relaxed);
+	Table* grown = new Table(capacity);
+	for (size_t i = 0; i <= old->mask; ++i) {
+		ChunkEntry* entry = old->slots[i].entry.load(std::memory_order_relaxed);
+		if (!entry) continue;
+
+		size_t j = home(*grown, entry->key);
+		while (grown->slots[j].key.load(std::memory_order_relaxed) != EMPTY) j = (j + 1) & grown->mask;
+		grown->slots[j].key.store(entry->key, std::memory_order_relaxed);
+		grown->slots[j].entry.store(entry, std::memory_order_relaxed);
+		++grown->used;
+	}
+
+	// Readers already probing the old table finish there, it is freed with the next grace period
+	table.store(grown, std::memory_order_release);
+	retiredTables.push_back({ globalEpoch.load(std::memory_order_relaxed), old });
+}
+
+void ChunkDirectory::retireEntry(ChunkEntry* entry) {
+	retiredEntries.push_back({ globalEpoch.load(std::memory_order_relaxed), entry });
+}
+
+void ChunkDirectory::releaseEntry(ChunkEntry* entry) {
+	if (entry->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+	// The chunk's voxels are the expensive part to free, the entry itself is a few bytes
+	if (entry->reclaimer && entry->chunk) entry->reclaimer->reclaim(std::move(entry->chunk));
+	delete entry;
+}
+
+void ChunkDirectory::collect() {
+	uint64_t epoch = globalEpoch.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	bool caughtUp = true;
+	for (const auto& reader : readers) {
+		uint64_t pinned = reader.epoch.load(std::memory_order_acquire);
+		if (pinned != IDLE && pinned != epoch) {
+			caughtUp = false;
+			break;
+		}
+	}
+	if (caughtUp) globalEpoch.store(++epoch, std::memory_order_seq_cst);
+
+	// Anything retired two epochs ago can't be reached by a reader that is still pinned
+	auto entriesEnd = std::find_if(retiredEntries.begin(), retiredEntries.end(), [epoch](const auto& r) { return r.epoch + 2 > epoch; });
+	for (auto it = retiredEntries.begin(); it != entriesEnd; ++it) releaseEntry(it->item);
+	retiredEntries.erase(retiredEntries.begin(), entriesEnd);
+
+	auto tablesEnd = std::find_if(retiredTables.begin(), retiredTables.end(), [epoch](const auto& r) { return r.epoch + 2 > epoch; });
+	for (auto it = retiredTables.begin(); it != tablesEnd; ++it) delete it->item;
+	retiredTables.erase(retiredTables.begin(), tablesEnd);
+}
+
+ChunkDirectoryStats ChunkDirectory::getStats() const {
+	ReadGuard guard(*this);
+	return {
+		live.load(std::memory_order_relaxed),
+		table.load(std::memory_order_acquire)->mask + 1,
+		globalEpoch.load(std::memory_order_relaxed)
+	};
+}
+
+ChunkDirectoryStressResult ChunkDirectory::stressTest(int readerThreads, double seconds) {
+	ChunkDirectory directory;
+	const int side = 48;
+
+	std::atomic<bool> stop{ false };
+	std::atomic<size_t> lookups{ 0 }, errors{ 0 };
+
+	auto wrongChunk = [](const Chunk& chunk, const ChunkUtils::ChunkCoordPair& key) {
+		return chunk.getChunkX() != key.first || chunk.getChunkZ() != key.second;
+	};
+
+	std::vector<std::thread> threads;
+	for (int r = 0; r < readerThreads; ++r) {
+		threads.emplace_back([&, r] {
+			uint32_t state = 0x9E3779B9u * (uint32_t)(r + 1);
+			size_t count = 0, bad = 0;
+			std::vector<ChunkRef> held;
+
+			while (!stop.load(std::memory_order_relaxed)) {
+				state ^= state << 13;
+				state ^= state >> 17;
+				state ^= state << 5;
+				ChunkUtils::ChunkCoordPair key = { (int)(state % side) - side / 2, (int)((state >> 16) % side) - side / 2 };
+
+				// Mostly plain lookups, now and then a counted reference kept across many writer operations
+				if ((state & 255) == 0) {
+					ChunkRef ref = directory.acquire(key);
+					if (ref) {
+						if (wrongChunk(*ref, key)) ++bad;
+						held.push_back(std::move(ref));
+						if (held.size() > 32) held.erase(held.begin());
+					}
+				}
+				else {
+					directory.read(key, [&](const Chunk& chunk) { if (wrongChunk(chunk, key)) ++bad; });
+				}
+				++count;
+			}
+
+			for (const auto& ref : held) {
+				if (ref->getChunkX() < -side / 2 || ref->getChunkX() >= side / 2) ++bad;
+			}
+			lookups += count;
+			errors += bad;
+		});
+	}
+
+	// This thread is the writer: random inserts, replacements and erases, with the odd clear to force table swaps
+	size_t inserts = 0, erases = 0;
+	uint32_t state = 0x2545F491u;
+	auto start = std::chrono::steady_clock::now();
+	auto deadline = start + std::chrono::duration<double>(seconds);
+	while (std::chrono::steady_clock::now() < deadline) {
+		for (int batch = 0; batch < 256; ++batch) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			ChunkUtils::ChunkCoordPair key = { (int)(state % side) - side / 2, (int)((state >> 16) % side) - side / 2 };
+
+			if ((state & 7) < 3 && directory.erase(key)) {
+				++erases;
+				continue;
+			}
+			auto chunk = std::make_unique<Chunk>();
+			chunk->setChunkCoords(key.first, key.second);
+			directory.insert(key, std::move(chunk));
+			++inserts;
+		}
+		if ((state & 1023) < 4) directory.clear();
+	}
+
+	stop = true;
+	for (auto& thread : threads) thread.join();
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	return { readerThreads, elapsed, lookups.load(), lookups.load() / elapsed, inserts, erases, errors.load() };
+}
\ No newline at end of file
@@ -1,36 +1,283 @@
 #include "h/Terrain/ChunkLoader.h"
+#include "h/Rendering/Utility/WindowConfig.h"
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 
-ChunkLoader::ChunkLoader() {
+namespace {
+	int floorSqrt(int value) {
+		int root = (int)std::sqrt((double)value);
+		while (root * root > value) --root;
+		while ((root + 1) * (root + 1) <= value) ++root;
+		return root;
+	}
+
+	// Emits every chunk of row z covered by the spans in 'from' but not by those in 'minus'
+	void subtractSpans(int z, const ChunkSpans& from, int fromCount, const ChunkSpans& minus, int minusCount, std::vector<ChunkUtils::ChunkCoordPair>& out) {
+		for (int i = 0; i < fromCount; ++i) {
+			int x = from[i].first;
+			for (int j = 0; j < minusCount && x <= from[i].second; ++j) {
+				if (minus[j].second < x) continue;
+				if (minus[j].first > from[i].second) break;
+				for (; x < minus[j].first; ++x) out.push_back({ x, z });
+				x = std::max(x, minus[j].second + 1);
+			}
+			for (; x <= from[i].second; ++x) out.push_back({ x, z });
+		}
+	}
+
+	template<typename Area>
+	void diffAreas(const Area& before, const Area& after, int minZ, int maxZ, std::vector<ChunkUtils::ChunkCoordPair>* entering, std::vector<ChunkUtils::ChunkCoordPair>* leaving) {
+		ChunkSpans beforeSpans, afterSpans;
+		for (int z = minZ; z <= maxZ; ++z) {
+			int beforeCount = before.rowSpans(z, beforeSpans);
+			int afterCount = after.rowSpans(z, afterSpans);
+			if (beforeCount == afterCount && std::equal(beforeSpans.begin(), beforeSpans.begin() + beforeCount, afterSpans.begin())) continue;
+			if (entering) subtractSpans(z, afterSpans, afterCount, beforeSpans, beforeCount, *entering);
+			if (leaving) subtractSpans(z, beforeSpans, beforeCount, afterSpans, afterCount, *leaving);
+		}
+	}
+
+	ChunkDisc emptyDisc() {
+		return { 0, 0, -1, -1 };
+	}
+}
+
+bool ChunkDisc::contains(int x, int z) const {
+	int dx = x - centerX, dz = z - centerZ;
+	return std::abs(dx) <= halfExtent && std::abs(dz) <= halfExtent && dx * dx + dz * dz <= radiusSquared;
+}
+
+int ChunkDisc::rowSpans(int z, ChunkSpans& spans) const {
+	int dz = z - centerZ;
+	if (std::abs(dz) > halfExtent || dz * dz > radiusSquared) return 0;
+	int halfWidth = std::min(floorSqrt(radiusSquared - dz * dz), halfExtent);
+	spans[0] = { centerX - halfWidth, centerX + halfWidth };
+	return 1;
+}
+
+int LoadRegion::rowSpans(int z, ChunkSpans& spans) const {
+	ChunkSpans focusSpans, aheadSpans;
+	int count = focus.rowSpans(z, focusSpans);
+	if (count) spans[0] = focusSpans[0];
+	if (!ahead.rowSpans(z, aheadSpans)) return count;
+	if (!count) {
+		spans[0] = aheadSpans[0];
+		return 1;
+	}
+
+	auto first = std::min(spans[0], aheadSpans[0]), second = std::max(spans[0], aheadSpans[0]);
+	if (second.first <= first.second + 1) {
+		spans[0] = { first.first, std::max(first.second, second.second) };
+		return 1;
+	}
+	spans[0] = first;
+	spans[1] = second;
+	return 2;
+}
+
+int LoadRegion::minZ() const {
+	int z = focus.centerZ - focus.halfExtent;
+	if (ahead.radiusSquared >= 0) z = std::min(z, ahead.centerZ - ahead.halfExtent);
+	return z;
+}
+
+int LoadRegion::maxZ() const {
+	int z = focus.centerZ + focus.halfExtent;
+	if (ahead.radiusSquared >= 0) z = std::max(z, ahead.centerZ + ahead.halfExtent);
+	return z;
+}
+
+int LoadRegion::reach() const {
+	if (focus.radiusSquared < 0) return -1;
+	int reach = focus.halfExtent;
+	if (ahead.radiusSquared >= 0) {
+		reach = std::max(reach, std::max(std::abs(ahead.centerX - focus.centerX), std::abs(ahead.centerZ - focus.centerZ)) + ahead.halfExtent);
+	}
+	return reach;
+}
+
+size_t LoadRegion::count() const {
+	size_t total = 0;
+	ChunkSpans spans;
+	for (int z = minZ(); z <= maxZ(); ++z) {
+		int count = rowSpans(z, spans);
+		for (int i = 0; i < count; ++i) total += spans[i].second - spans[i].first + 1;
+	}
+	return total;
+}
+
+LoadRegion LoadRegion::empty() {
+	return { emptyDisc(), emptyDisc() };
+}
+
+LoadSpiral::LoadSpiral(const LoadRegion& region, int firstRing)
+	: region(region)
+	, ring(std::max(firstRing, 0))
+{
+
+}
+
+bool LoadSpiral::nextRing(std::vector<ChunkUtils::ChunkCoordPair>& out) {
+	if (done()) return false;
+
+	int cx = region.focus.centerX, cz = region.focus.centerZ;
+	auto visit = [&](int x, int z) {
+		if (region.contains({ x, z })) out.push_back({ x, z });
+	};
+
+	if (ring == 0) visit(cx, cz);
+	else {
+		for (int x = cx - ring; x <= cx + ring; ++x) {
+			visit(x, cz - ring);
+			visit(x, cz + ring);
+		}
+		for (int z = cz - ring + 1; z <= cz + ring - 1; ++z) {
+			visit(cx - ring, z);
+			visit(cx + ring, z);
+		}
+	}
+	++ring;
+	return true;
+}
+
+LodSelector LodSelector::fromScreenSpaceError(float projectionScale, int viewportHeight, float maxErrorPixels) {
+	LodSelector selector;
+	selector.maxErrorPixels = std::max(maxErrorPixels, 0.01f);
+
+	// Pixels covered by one block seen from one block away, it falls off linearly with distance
+	float pixelsPerBlock = projectionScale * viewportHeight * 0.5f;
+	for (int lod = 0; lod < (int)selector.radii.size(); ++lod) {
+		float nextError = (float)((1 << (lod + 1)) - 1);
+		float distance = nextError * pixelsPerBlock / selector.maxErrorPixels / ChunkUtils::WIDTH;	// where the next level is good enough
+		selector.radii[lod] = std::max((int)std::ceil(distance), 1);
+		selector.flatRadii[lod] = std::max((int)std::ceil(distance * FLAT_ERROR_WEIGHT), 1);
+	}
+	return selector;
+}
+
+int LodSelector::levelOfDetail(int dx, int dz, bool flat) const {
+	const auto& bands = flat ? flatRadii : radii;
+	int distanceSquared = dx * dx + dz * dz;
+	for (int lod = 0; lod < (int)bands.size(); ++lod) {
+		if (distanceSquared <= bands[lod] * bands[lod]) return lod;
+	}
+	return (int)bands.size();
+}
+
+int LodSelector::levelOfDetail(int dx, int dz, int currentLod, bool flat) const {
+	int lod = levelOfDetail(dx, dz, flat);
+	if (currentLod < 0) return lod;
+
+	const auto& bands = flat ? flatRadii : radii;
+	auto square = [](int r) { return r * r; };
+	int distanceSquared = dx * dx + dz * dz;
+	// Coarser: hold each finer level while still within the hysteresis margin past its outer edge
+	while (lod > currentLod && distanceSquared <= square(bands[lod - 1] + LOD_HYSTERESIS)) --lod;
+	// Finer: skip each finer level until clearly inside it
+	while (lod < currentLod && distanceSquared > square(std::max(bands[lod] - LOD_HYSTERESIS, 0))) ++lod;
+	return lod;
+}
 
+std::vector<int> LodSelector::thresholds() const {
+	std::vector<int> out;
+	for (const auto* bands : { &radii, &flatRadii }) {
+		for (int radius : *bands) {
+			out.push_back(std::max(radius - LOD_HYSTERESIS, 0));
+			out.push_back(radius + LOD_HYSTERESIS);
+		}
+	}
+	std::sort(out.begin(), out.end());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
+	return out;
 }
 
-std::vector<std::pair<int, int>> ChunkLoader::getLoadList(int chunkX, int chunkZ, int renderRadius) {
-	std::vector<std::pair<int, int>> loadList;
+ChunkLoader::ChunkLoader()
+	: region(LoadRegion::empty())
+	, revision(0)
+	, loaded(false)
+	, lodSelector(LodSelector::fromScreenSpaceError(1.f / std::tan((float)WindowDetails::FOV * 3.14159265f / 360.f), WindowDetails::WindowHeight, LodSelector::DEFAULT_MAX_ERROR_PIXELS))
+	, lodSelectorChanged(false)
+{
+
+}
 
-	for (int x = chunkX - renderRadius; x <= chunkX + renderRadius; x++) {
-		for (int z = chunkZ - renderRadius; z <= chunkZ + renderRadius; z++) {
-			if ((x - chunkX) * (x - chunkX) + (z - chunkZ) * (z - chunkZ) <= renderRadius * renderRadius && x != chunkX - renderRadius && x != chunkX + renderRadius && z != chunkZ - renderRadius && z != chunkZ + renderRadius) {
-				std::pair<int, int> currentChunk = { x, z };
-				loadList.push_back(currentChunk);
+LoadDelta ChunkLoader::moveTo(int chunkX, int chunkZ, int renderRadius, const glm::vec2& lead) {
+	LoadRegion next = LoadRegion::empty();
+	if (renderRadius > 0) {
+		// The square's border is left out, as it always was
+		next.focus = { chunkX, chunkZ, renderRadius * renderRadius, renderRadius - 1 };
+
+		// Prefetch the crescent the camera is about to move into, only the part outside the focus disc is new
+		int leadX = (int)std::round(lead.x), leadZ = (int)std::round(lead.y);
+		if (leadX != 0 || leadZ != 0) next.ahead = { chunkX + leadX, chunkZ + leadZ, (renderRadius - 1) * (renderRadius - 1), renderRadius - 1 };
+	}
+
+	LoadDelta delta;
+	++revision;
+	delta.refill = !loaded;
+	if (delta.refill) {
+		region = next;
+		loaded = true;
+		return delta;
+	}
+
+	int minZ = std::min(region.minZ(), next.minZ()), maxZ = std::max(region.maxZ(), next.maxZ());
+	diffAreas(region, next, minZ, maxZ, &delta.entering, &delta.leaving);
+
+	if (lodSelectorChanged) {
+		// Every band moved, so every chunk that stays loaded gets its level checked again
+		ChunkSpans spans;
+		for (int z = next.minZ(); z <= next.maxZ(); ++z) {
+			int count = next.rowSpans(z, spans);
+			for (int i = 0; i < count; ++i) {
+				for (int x = spans[i].first; x <= spans[i].second; ++x) {
+					if (region.contains({ x, z })) delta.lodChanged.push_back({ x, z });
+				}
 			}
 		}
+		lodSelectorChanged = false;
+	}
+	// Chunks that stay loaded but crossed a detail threshold, the symmetric difference of each threshold's disc before
+	// and after. With hysteresis a chunk changes level only on the inner or outer threshold of a band edge, never the edge
+	else if (region.focus.centerX != chunkX || region.focus.centerZ != chunkZ) {
+		for (int radius : lodSelector.thresholds()) {
+			ChunkDisc before = { region.focus.centerX, region.focus.centerZ, radius * radius, radius };
+			ChunkDisc after = { chunkX, chunkZ, radius * radius, radius };
+			int bandMinZ = std::min(before.centerZ, after.centerZ) - radius, bandMaxZ = std::max(before.centerZ, after.centerZ) + radius;
+			diffAreas(before, after, bandMinZ, bandMaxZ, &delta.lodChanged, &delta.lodChanged);
+		}
+		delta.lodChanged.erase(std::remove_if(delta.lodChanged.begin(), delta.lodChanged.end(),
+			[&](const ChunkUtils::ChunkCoordPair& key) { return !next.contains(key) || !region.contains(key); }), delta.lodChanged.end());
 	}
 
-	std::sort(loadList.begin(), loadList.end(), [chunkX, chunkZ](const auto& left, const auto& right) {
-		int dxLeft = chunkX - left.first;
-		int dzLeft = chunkZ - left.second;
-		int distSquaredLeft = dxLeft * dxLeft + dzLeft * dzLeft;
+	region = next;
+	return delta;
+}
+
+float ChunkLoader::loadPriority(float dx, float dz, const glm::vec2& forward, const glm::vec2& lead) {
+	glm::vec2 offset(dx, dz);
+	float distance = glm::length(offset);
+	float facing = distance > 0.f ? glm::dot(offset, forward) / distance : 1.f;
+	float stretch = 1.5f - 0.5f * facing;
+	float priority = distance * stretch;
 
-		int dxRight = chunkX - right.first;
-		int dzRight = chunkZ - right.second;
-		int distSquaredRight = dxRight * dxRight + dzRight * dzRight;
+	float leadLength = glm::length(lead);
+	if (leadLength < 0.5f) return priority;
 
-		// Compare squared distances
-		return distSquaredLeft < distSquaredRight;
-		});
-	
-	return loadList;
+	// Where along the next PREFETCH_SECONDS of travel this chunk is closest to the camera's path
+	float along = glm::dot(offset, lead) / leadLength;
+	float t = std::clamp(along / leadLength, 0.f, 1.f);
+	float pathDistance = glm::length(offset - lead * t);
+	priority = std::min(priority, pathDistance * stretch + t * leadLength * PATH_TRAVEL_WEIGHT);
+
+	if (along < 0.f) priority -= along * BEHIND_MOTION_WEIGHT;
+	return priority;
+}
 
+void ChunkLoader::setLodSelector(const LodSelector& selector) {
+	if (selector == lodSelector) return;
+	lodSelector = selector;
+	lodSelectorChanged = loaded;
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "h/Terrain/ChunkReclaimer.h"
+#include <chrono>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+ChunkReclaimer::ChunkReclaimer()
+	: pushed(0)
+	, reclaimed(0)
+	, maxBatchMs(0.0)
+	, stopping(false)
+{
+	worker = std::thread(&ChunkReclaimer::run, this);
+#ifdef _WIN32
+	// Freeing memory is never urgent, it should only soak up time nothing else wants
+	SetThreadPriority(worker.native_handle(), THREAD_PRIORITY_LOWEST);
+#endif
+}
+
+ChunkReclaimer::~ChunkReclaimer() {
+	stopping.store(true, std::memory_order_release);
+	pushed.fetch_add(1, std::memory_order_release);	// wakes the worker without a chunk behind it
+	pushed.notify_one();
+	if (worker.joinable()) worker.join();
+	queue.drain([](std::unique_ptr<Chunk>&&) {});
+}
+
+void ChunkReclaimer::reclaim(std::unique_ptr<Chunk> chunk) {
+	queue.push(std::move(chunk));
+	pushed.fetch_add(1, std::memory_order_release);
+	pushed.notify_one();
+}
+
+ChunkReclaimerStats ChunkReclaimer::getStats() const {
+	uint64_t done = reclaimed.load(std::memory_order_relaxed);
+	uint64_t total = pushed.load(std::memory_order_relaxed);
+	return { total > done ? total - done : 0, done, maxBatchMs.load(std::memory_order_relaxed) };
+}
+
+void ChunkReclaimer::run() {
+	uint64_t seen = 0;
+	while (!stopping.load(std::memory_order_acquire)) {
+		pushed.wait(seen, std::memory_order_acquire);
+		seen = pushed.load(std::memory_order_acquire);
+
+		auto start = std::chrono::steady_clock::now();
+		size_t count = queue.drain([](std::unique_ptr<Chunk>&& chunk) { chunk.reset(); });
+		if (!count) continue;
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (ms > maxBatchMs.load(std::memory_order_relaxed)) maxBatchMs.store(ms, std::memory_order_relaxed);
+		reclaimed.fetch_add(count, std::memory_order_relaxed);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "h/Terrain/ChunkRetentionCache.h"
+#include <algorithm>
+
+ChunkRetentionCache::ChunkRetentionCache(size_t voxelBudgetBytes, size_t meshBudgetBytes)
+	: voxelBudget(voxelBudgetBytes)
+	, meshBudget(meshBudgetBytes)
+	, voxelBytes(0)
+	, meshBytes(0)
+	, meshes(0)
+	, hits(0)
+	, meshHits(0)
+	, misses(0)
+{
+
+}
+
+void ChunkRetentionCache::store(const ChunkUtils::ChunkCoordPair& key, int lod, const std::vector<BlockID>& blocks, const std::array<int, 4>& neighbourLods,
+	size_t keptMeshBytes, std::vector<ChunkUtils::ChunkCoordPair>& releasedMeshes)
+{
+	// Encoded before taking the lock, the overlay shouldn't wait on it
+	RetainedChunk retained = { lod, encode(blocks), neighbourLods, keptMeshBytes };
+	retained.runs.shrink_to_fit();
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto existing = index.find(key);
+	if (existing != index.end()) erase(existing->second, releasedMeshes);
+
+	if (retained.meshBytes > meshBudget) {
+		releasedMeshes.push_back(key);
+		retained.meshBytes = 0;
+	}
+	if (retained.voxelBytes() > voxelBudget) {
+		if (retained.meshBytes) releasedMeshes.push_back(key);
+		return;
+	}
+
+	voxelBytes += retained.voxelBytes();
+	meshBytes += retained.meshBytes;
+	if (retained.meshBytes) ++meshes;
+	lru.emplace_front(key, std::move(retained));
+	index[key] = lru.begin();
+	trim(releasedMeshes);
+}
+
+std::optional<RetainedChunk> ChunkRetentionCache::take(const ChunkUtils::ChunkCoordPair& key, int lod, std::vector<ChunkUtils::ChunkCoordPair>& releasedMeshes) {
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = index.find(key);
+	if (it == index.end()) {
+		++misses;
+		return std::nullopt;
+	}
+	if (it->second->second.lod != lod) {
+		// Voxels at another resolution are no use, and neither is their mesh
+		erase(it->second, releasedMeshes);
+		++misses;
+		return std::nullopt;
+	}
+
+	RetainedChunk retained = std::move(it->second->second);
+	voxelBytes -= retained.voxelBytes();
+	meshBytes -= retained.meshBytes;
+	if (retained.meshBytes) --meshes;
+	lru.erase(it->second);
+	index.erase(it);
+	++hits;
+	return retained;
+}
+
+void ChunkRetentionCache::recordMeshHit() {
+	std::lock_guard<std::mutex> lock(mtx);
+	++meshHits;
+}
+
+void ChunkRetentionCache::clear(std::vector<ChunkUtils::ChunkCoordPair>& releasedMeshes) {
+	std::lock_guard<std::mutex> lock(mtx);
+	for (const auto& [key, retained] : lru) {
+		if (retained.meshBytes) releasedMeshes.push_back(key);
+	}
+	lru.clear();
+	index.clear();
+	voxelBytes = meshBytes = meshes = 0;
+}
+
+RetentionStats ChunkRetentionCache::getStats() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	size_t lookups = hits + misses;
+	return { lru.size(), voxelBytes, voxelBudget, meshes, meshBytes, meshBudget, hits, meshHits, misses,
+		lookups ? (double)hits / lookups : 0.0 };
+}
+
+std::vector<VoxelRun> ChunkRetentionCache::encode(const std::vector<BlockID>& blocks) {
+	// Flat order walks x fastest then z then y, so each layer of sky, stone or dirt collapses to a handful of runs
+	std::vector<VoxelRun> runs;
+	for (size_t i = 0; i < blocks.size();) {
+		BlockID block = blocks[i];
+		size_t end = i + 1;
+		size_t limit = std::min(blocks.size(), i + UINT16_MAX);
+		while (end < limit && blocks[end] == block) ++end;
+		runs.push_back({ (uint16_t)(end - i), block });
+		i = end;
+	}
+	return runs;
+}
+
+std::vector<BlockID> ChunkRetentionCache::decode(const std::vector<VoxelRun>& runs, size_t length) {
+	std::vector<BlockID> blocks;
+	blocks.reserve(length);
+	for (const VoxelRun& run : runs) blocks.insert(blocks.end(), run.length, run.block);
+	blocks.resize(length, BlockID::AIR);
+	return blocks;
+}
+
+void ChunkRetentionCache::erase(LruList::iterator it, std::vector<ChunkUtils::ChunkCoordPair>& releasedMeshes) {
+	const RetainedChunk& retained = it->second;
+	voxelBytes -= retained.voxelBytes();
+	if (retained.meshBytes) {
+		meshBytes -= retained.meshBytes;
+		--meshes;
+		releasedMeshes.push_back(it->first);
+	}
+	index.erase(it->first);
+	lru.erase(it);
+}
+
+void ChunkRetentionCache::trim(std::vector<ChunkUtils::ChunkCoordPair>& releasedMeshes) {
+	// The mesh budget gives up the oldest buckets while keeping their voxels, the voxel budget drops whole chunks
+	for (auto it = lru.end(); meshBytes > meshBudget && it != lru.begin();) {
+		--it;
+		if (!it->second.meshBytes) continue;
+		meshBytes -= it->second.meshBytes;
+		--meshes;
+		it->second.meshBytes = 0;
+		releasedMeshes.push_back(it->first);
+	}
+	while (voxelBytes > voxelBudget && !lru.empty()) erase(std::prev(lru.end()), releasedMeshes);
+}
\ No newline at end of file
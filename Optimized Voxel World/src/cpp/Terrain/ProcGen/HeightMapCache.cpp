@@ -0,0 +1,55 @@
+#include "h/Terrain/ProcGen/HeightMapCache.h"
+
+HeightMapCache::HeightMapCache(size_t budgetBytes)
+	: budget(budgetBytes)
+	, bytes(0)
+	, hits(0)
+	, misses(0)
+{
+
+}
+
+HeightMapTile HeightMapCache::find(const ChunkUtils::ChunkCoordPair& key, uint64_t noiseHash) {
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = index.find({ key, noiseHash });
+	if (it == index.end()) {
+		++misses;
+		return nullptr;
+	}
+	lru.splice(lru.begin(), lru, it->second);
+	++hits;
+	return it->second->second;
+}
+
+void HeightMapCache::insert(const ChunkUtils::ChunkCoordPair& key, uint64_t noiseHash, HeightMapTile tile) {
+	if (!tile || tileBytes(tile) > budget) return;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	TileKey tileKey = { key, noiseHash };
+	// Two threads that missed on the same column computed the same tile, the first one in stays
+	if (index.count(tileKey)) return;
+
+	bytes += tileBytes(tile);
+	lru.emplace_front(tileKey, std::move(tile));
+	index[tileKey] = lru.begin();
+
+	while (bytes > budget && !lru.empty()) {
+		auto last = std::prev(lru.end());
+		bytes -= tileBytes(last->second);
+		index.erase(last->first);
+		lru.erase(last);
+	}
+}
+
+void HeightMapCache::clear() {
+	std::lock_guard<std::mutex> lock(mtx);
+	lru.clear();
+	index.clear();
+	bytes = 0;
+}
+
+HeightMapCacheStats HeightMapCache::getStats() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	size_t lookups = hits + misses;
+	return { lru.size(), bytes, budget, hits, misses, lookups ? (double)hits / lookups : 0.0 };
+}
\ No newline at end of file
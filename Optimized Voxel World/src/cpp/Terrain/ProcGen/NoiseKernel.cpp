@@ -0,0 +1,376 @@
+#include "h/Terrain/ProcGen/NoiseKernel.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#define NOISE_KERNEL_SSE2
+#define NOISE_KERNEL_AVX2
+#define NOISE_KERNEL_AVX2_RUNTIME	// MSVC takes AVX2 intrinsics without /arch, they only run where cpuid allows
+#else
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__)
+#define NOISE_KERNEL_SSE2
+#endif
+#if defined(__AVX2__)
+#define NOISE_KERNEL_AVX2
+#endif
+#endif
+
+namespace {
+
+// FastNoise's 2D gradients, GRAD_X and GRAD_Y in FastNoise.cpp
+const float GRAD_X[12] = { 1, -1, 1, -1, 1, -1, 1, -1, 0, 0, 0, 0 };
+const float GRAD_Y[12] = { 1, 1, -1, -1, 0, 0, 0, 0, 1, -1, 1, -1 };
+
+// Every operation the kernel needs, one lane at a time. Also finishes rows that don't fill a whole vector
+struct ScalarLanes {
+	static constexpr int WIDTH = 1;
+	using F = float;
+	using I = int;
+
+	static F set(float v) { return v; }
+	static I seti(int v) { return v; }
+	static I ramp(int base, int) { return base; }
+	static F add(F a, F b) { return a + b; }
+	static F sub(F a, F b) { return a - b; }
+	static F mul(F a, F b) { return a * b; }
+	static I addi(I a, I b) { return a + b; }
+	static I low8(I a) { return a & 0xff; }
+	// FastNoise's FastFloor, which is one low at negative integers. Copied as is, the lattice must match
+	static I fastFloor(F f) { return f >= 0 ? (int)f : (int)f - 1; }
+	static F toFloat(I i) { return (float)i; }
+	static I gather(const int* table, I i) { return table[i]; }
+	static F gather(const float* table, I i) { return table[i]; }
+	static void store(float* out, F v) { *out = v; }
+};
+
+#ifdef NOISE_KERNEL_SSE2
+// Baseline on every x64 CPU, gathers are emulated with scalar loads
+struct Sse2Lanes {
+	static constexpr int WIDTH = 4;
+	using F = __m128;
+	using I = __m128i;
+
+	static F set(float v) { return _mm_set1_ps(v); }
+	static I seti(int v) { return _mm_set1_epi32(v); }
+	static I ramp(int base, int step) { return _mm_setr_epi32(base, base + step, base + 2 * step, base + 3 * step); }
+	static F add(F a, F b) { return _mm_add_ps(a, b); }
+	static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+	static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+	static I addi(I a, I b) { return _mm_add_epi32(a, b); }
+	static I low8(I a) { return _mm_and_si128(a, _mm_set1_epi32(0xff)); }
+	static I fastFloor(F f) { return _mm_add_epi32(_mm_cvttps_epi32(f), _mm_castps_si128(_mm_cmplt_ps(f, _mm_setzero_ps()))); }
+	static F toFloat(I i) { return _mm_cvtepi32_ps(i); }
+	static I gather(const int* table, I i) {
+		alignas(16) int index[4];
+		_mm_store_si128((__m128i*)index, i);
+		return _mm_setr_epi32(table[index[0]], table[index[1]], table[index[2]], table[index[3]]);
+	}
+	static F gather(const float* table, I i) {
+		alignas(16) int index[4];
+		_mm_store_si128((__m128i*)index, i);
+		return _mm_setr_ps(table[index[0]], table[index[1]], table[index[2]], table[index[3]]);
+	}
+	static void store(float* out, F v) { _mm_storeu_ps(out, v); }
+};
+#endif
+
+#ifdef NOISE_KERNEL_AVX2
+struct Avx2Lanes {
+	static constexpr int WIDTH = 8;
+	using F = __m256;
+	using I = __m256i;
+
+	static F set(float v) { return _mm256_set1_ps(v); }
+	static I seti(int v) { return _mm256_set1_epi32(v); }
+	static I ramp(int base, int step) {
+		return _mm256_add_epi32(_mm256_set1_epi32(base), _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(step)));
+	}
+	static F add(F a, F b) { return _mm256_add_ps(a, b); }
+	static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+	static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+	static I addi(I a, I b) { return _mm256_add_epi32(a, b); }
+	static I low8(I a) { return _mm256_and_si256(a, _mm256_set1_epi32(0xff)); }
+	static I fastFloor(F f) { return _mm256_add_epi32(_mm256_cvttps_epi32(f), _mm256_castps_si256(_mm256_cmp_ps(f, _mm256_setzero_ps(), _CMP_LT_OQ))); }
+	static F toFloat(I i) { return _mm256_cvtepi32_ps(i); }
+	static I gather(const int* table, I i) { return _mm256_i32gather_epi32(table, i, 4); }
+	static F gather(const float* table, I i) { return _mm256_i32gather_ps(table, i, 4); }
+	static void store(float* out, F v) { _mm256_storeu_ps(out, v); }
+};
+#endif
+
+// The arithmetic below follows FastNoise operation for operation, without fused multiply-adds, so every lane rounds
+// the way the scalar code does
+template<class L, FastNoise::Interp Interp>
+typename L::F interpolate(typename L::F t) {
+	if constexpr (Interp == FastNoise::Hermite) {
+		return L::mul(L::mul(t, t), L::sub(L::set(3.0f), L::mul(L::set(2.0f), t)));
+	}
+	else if constexpr (Interp == FastNoise::Quintic) {
+		return L::mul(L::mul(L::mul(t, t), t), L::add(L::mul(t, L::sub(L::mul(t, L::set(6.0f)), L::set(15.0f))), L::set(10.0f)));
+	}
+	else {
+		return t;
+	}
+}
+
+template<class L>
+typename L::F lerp(typename L::F a, typename L::F b, typename L::F t) {
+	return L::add(a, L::mul(t, L::sub(b, a)));
+}
+
+// SingleValue or SinglePerlin
+template<class L, FastNoise::NoiseType Type, FastNoise::Interp Interp>
+typename L::F single(const NoiseKernel::State& s, int offset, typename L::F x, typename L::F y) {
+	using F = typename L::F;
+	using I = typename L::I;
+
+	I x0 = L::fastFloor(x);
+	I y0 = L::fastFloor(y);
+	I x1 = L::addi(x0, L::seti(1));
+	I y1 = L::addi(y0, L::seti(1));
+
+	F xd0 = L::sub(x, L::toFloat(x0));
+	F yd0 = L::sub(y, L::toFloat(y0));
+	F xs = interpolate<L, Interp>(xd0);
+	F ys = interpolate<L, Interp>(yd0);
+
+	// Index2D_256: perm[(x & 0xff) + perm[(y & 0xff) + offset]], the outer lookup is folded into the tables
+	I row0 = L::gather(s.perm, L::addi(L::low8(y0), L::seti(offset)));
+	I row1 = L::gather(s.perm, L::addi(L::low8(y1), L::seti(offset)));
+	I i00 = L::addi(L::low8(x0), row0);
+	I i10 = L::addi(L::low8(x1), row0);
+	I i01 = L::addi(L::low8(x0), row1);
+	I i11 = L::addi(L::low8(x1), row1);
+
+	if constexpr (Type == FastNoise::Value) {
+		F xf0 = lerp<L>(L::gather(s.valueLut, i00), L::gather(s.valueLut, i10), xs);
+		F xf1 = lerp<L>(L::gather(s.valueLut, i01), L::gather(s.valueLut, i11), xs);
+		return lerp<L>(xf0, xf1, ys);
+	}
+	else {
+		F xd1 = L::sub(xd0, L::set(1.0f));
+		F yd1 = L::sub(yd0, L::set(1.0f));
+		auto grad = [&](I i, F xd, F yd) { return L::add(L::mul(xd, L::gather(s.gradX, i)), L::mul(yd, L::gather(s.gradY, i))); };
+
+		F xf0 = lerp<L>(grad(i00, xd0, yd0), grad(i10, xd1, yd0), xs);
+		F xf1 = lerp<L>(grad(i01, xd0, yd1), grad(i11, xd1, yd1), xs);
+		return lerp<L>(xf0, xf1, ys);
+	}
+}
+
+// GetValue / GetPerlin, or their FBM fractals
+template<class L, FastNoise::NoiseType Type, FastNoise::Interp Interp, bool Fractal>
+typename L::F sample(const NoiseKernel::State& s, typename L::F x, typename L::F y) {
+	x = L::mul(x, L::set(s.frequency));
+	y = L::mul(y, L::set(s.frequency));
+	if constexpr (!Fractal) {
+		return single<L, Type, Interp>(s, 0, x, y);
+	}
+	else {
+		typename L::F sum = single<L, Type, Interp>(s, s.perm[0], x, y);
+		float amp = 1;
+		for (int i = 1; i < s.octaves; ++i) {
+			x = L::mul(x, L::set(s.lacunarity));
+			y = L::mul(y, L::set(s.lacunarity));
+			amp *= s.gain;
+			sum = L::add(sum, L::mul(single<L, Type, Interp>(s, s.perm[i], x, y), L::set(amp)));
+		}
+		return L::mul(sum, L::set(s.fractalBounding));
+	}
+}
+
+template<class L, FastNoise::NoiseType Type, FastNoise::Interp Interp, bool Fractal>
+void fillLanes(const NoiseKernel::State& s, float* out, int originX, int originZ, int step, int countX, int countZ, float offset) {
+	for (int x = 0; x < countX; ++x) {
+		int worldX = originX + x * step;
+		float* row = out + (size_t)x * countZ;
+		typename L::F laneX = L::set((float)worldX + offset);
+
+		int z = 0;
+		for (; z + L::WIDTH <= countZ; z += L::WIDTH) {
+			L::store(row + z, sample<L, Type, Interp, Fractal>(s, laneX, L::add(L::toFloat(L::ramp(originZ + z * step, step)), L::set(offset))));
+		}
+		for (; z < countZ; ++z) {
+			row[z] = sample<ScalarLanes, Type, Interp, Fractal>(s, (float)worldX + offset, (float)(originZ + z * step) + offset);
+		}
+	}
+}
+
+float sampleFastNoise(const FastNoise& noise, FastNoise::NoiseType sampler, float x, float y) {
+	switch (sampler) {
+	case FastNoise::Value: return noise.GetValue(x, y);
+	case FastNoise::ValueFractal: return noise.GetValueFractal(x, y);
+	case FastNoise::Perlin: return noise.GetPerlin(x, y);
+	case FastNoise::PerlinFractal: return noise.GetPerlinFractal(x, y);
+	case FastNoise::Simplex: return noise.GetSimplex(x, y);
+	case FastNoise::SimplexFractal: return noise.GetSimplexFractal(x, y);
+	case FastNoise::Cellular: return noise.GetCellular(x, y);
+	case FastNoise::WhiteNoise: return noise.GetWhiteNoise(x, y);
+	case FastNoise::Cubic: return noise.GetCubic(x, y);
+	case FastNoise::CubicFractal: return noise.GetCubicFractal(x, y);
+	}
+	return 0.0f;
+}
+
+void fillFallback(const NoiseKernel::State& s, float* out, int originX, int originZ, int step, int countX, int countZ, float offset) {
+	for (int x = 0; x < countX; ++x) {
+		for (int z = 0; z < countZ; ++z) {
+			out[(size_t)x * countZ + z] = sampleFastNoise(s.noise, s.sampler, (float)(originX + x * step) + offset, (float)(originZ + z * step) + offset);
+		}
+	}
+}
+
+template<class L, FastNoise::NoiseType Type>
+NoiseKernel::FillFn selectInterp(FastNoise::Interp interp, bool fractal) {
+	switch (interp) {
+	case FastNoise::Linear: return fractal ? &fillLanes<L, Type, FastNoise::Linear, true> : &fillLanes<L, Type, FastNoise::Linear, false>;
+	case FastNoise::Hermite: return fractal ? &fillLanes<L, Type, FastNoise::Hermite, true> : &fillLanes<L, Type, FastNoise::Hermite, false>;
+	case FastNoise::Quintic: return fractal ? &fillLanes<L, Type, FastNoise::Quintic, true> : &fillLanes<L, Type, FastNoise::Quintic, false>;
+	}
+	return nullptr;
+}
+
+// Null for anything the lanes don't cover
+template<class L>
+NoiseKernel::FillFn select(const FastNoise& noise, FastNoise::NoiseType sampler) {
+	bool fractal = sampler == FastNoise::ValueFractal || sampler == FastNoise::PerlinFractal;
+	if (fractal && noise.GetFractalType() != FastNoise::FBM) return nullptr;
+
+	switch (sampler) {
+	case FastNoise::Value:
+	case FastNoise::ValueFractal:
+		return selectInterp<L, FastNoise::Value>(noise.GetInterp(), fractal);
+	case FastNoise::Perlin:
+	case FastNoise::PerlinFractal:
+		return selectInterp<L, FastNoise::Perlin>(noise.GetInterp(), fractal);
+	default:
+		return nullptr;
+	}
+}
+
+bool cpuHasAvx2() {
+#if defined(NOISE_KERNEL_AVX2_RUNTIME)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;	// the OS must save the ymm registers too
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(NOISE_KERNEL_AVX2)
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool useAvx2() {
+	static const bool supported = cpuHasAvx2();
+	return supported;
+}
+
+}
+
+NoiseKernel::NoiseKernel()
+	: NoiseKernel(FastNoise(), FastNoise::Value)
+{
+
+}
+
+NoiseKernel::NoiseKernel(const FastNoise& noise, FastNoise::NoiseType sampler)
+	: fill(nullptr)
+{
+	state.noise = noise;
+	state.sampler = sampler;
+	state.frequency = noise.GetFrequency();
+	state.lacunarity = noise.GetFractalLacunarity();
+	state.gain = noise.GetFractalGain();
+	state.octaves = noise.GetFractalOctaves();
+
+	// CalculateFractalBounding
+	float amp = state.gain;
+	float ampFractal = 1.0f;
+	for (int i = 1; i < state.octaves; i++) {
+		ampFractal += amp;
+		amp *= state.gain;
+	}
+	state.fractalBounding = 1.0f / ampFractal;
+
+	// The same shuffle SetSeed runs, the permutation itself is private to FastNoise
+	unsigned char perm[512];
+	std::mt19937_64 gen(noise.GetSeed());
+	for (int i = 0; i < 256; i++) perm[i] = i;
+	for (int j = 0; j < 256; j++) {
+		int rng = (int)(gen() % (256 - j));
+		int k = rng + j;
+		int l = perm[j];
+		perm[j] = perm[j + 256] = perm[k];
+		perm[k] = l;
+	}
+
+	// So is the value table, but GetValue at integer coordinates returns its entries untouched: at (x, 0) the
+	// entry is VAL_LUT[perm[x + perm[0]]], which walks all 256 of them
+	FastNoise probe = noise;
+	probe.SetFrequency(1.0f);
+	for (int x = 0; x < 256; x++) state.valueLut[(x + perm[0]) & 0xff] = probe.GetValue((float)x, 0.0f);
+
+	for (int i = 0; i < 512; i++) {
+		state.perm[i] = perm[i];
+		if (i >= 256) state.valueLut[i] = state.valueLut[i - 256];
+		state.gradX[i] = GRAD_X[perm[i] % 12];
+		state.gradY[i] = GRAD_Y[perm[i] % 12];
+	}
+
+#ifdef NOISE_KERNEL_AVX2
+	if (useAvx2()) fill = select<Avx2Lanes>(noise, sampler);
+#endif
+#ifdef NOISE_KERNEL_SSE2
+	if (!fill) fill = select<Sse2Lanes>(noise, sampler);
+#endif
+	if (!fill) fill = select<ScalarLanes>(noise, sampler);
+	if (!fill) fill = &fillFallback;
+}
+
+void NoiseKernel::fillGrid(float* out, int originX, int originZ, int step, int countX, int countZ, float offset) const {
+	fill(state, out, originX, originZ, step, countX, countZ, offset);
+}
+
+const char* NoiseKernel::instructionSet() {
+#ifdef NOISE_KERNEL_AVX2
+	if (useAvx2()) return "AVX2";
+#endif
+#ifdef NOISE_KERNEL_SSE2
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+float NoiseKernel::validate(const FastNoise& noise, FastNoise::NoiseType sampler) {
+	NoiseKernel kernel(noise, sampler);
+	const int side = 64;
+	std::vector<float> grid(side * side);
+
+	// Both signs of both axes, a coarse step, and coordinates far enough out for float spacing to show
+	const int origins[4][3] = { { 0, 0, 1 }, { -1000, 777, 1 }, { 123456, -98765, 3 }, { -3000, -3000, 32 } };
+	float maxError = 0.0f;
+	for (const auto& origin : origins) {
+		kernel.fillGrid(grid.data(), origin[0], origin[1], origin[2], side, side);
+		for (int x = 0; x < side; ++x) {
+			for (int z = 0; z < side; ++z) {
+				float expected = sampleFastNoise(noise, sampler, (float)(origin[0] + x * origin[2]), (float)(origin[1] + z * origin[2]));
+				maxError = std::max(maxError, std::fabs(grid[x * side + z] - expected));
+			}
+		}
+	}
+	return maxError;
+}
\ No newline at end of file
@@ -1,50 +1,149 @@
 #include "h/Terrain/ProcGen/ProcGen.h"
 #include <time.h>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <thread>
 
-ProcGen::ProcGen() : 
-	heightAmplitude(80)
+ProcGen::ProcGen()
+	: heightMapCache(HeightMapCache::DEFAULT_BUDGET)
 {
 	srand(time(NULL));
+	auto initial = std::make_shared<NoiseConfig>();
+	initial->heightAmplitude = 80;
 	for (int i = 0; i < 4; i++) {
-		heightMapNoise[i].SetFractalType(FastNoise::FractalType::FBM);
-		heightMapNoise[i].SetNoiseType(FastNoise::NoiseType::Perlin);
-		heightMapNoise[i].SetInterp(FastNoise::Interp::Quintic);
-		heightMapNoise[i].SetFractalOctaves((FN_DECIMAL)(4 - i) * 2);
-		heightMapNoise[i].SetFractalLacunarity((FN_DECIMAL)2);
-		heightMapNoise[i].SetFractalGain((FN_DECIMAL)0.5);
+		initial->heightMapNoise[i].SetFractalType(FastNoise::FractalType::FBM);
+		initial->heightMapNoise[i].SetNoiseType(FastNoise::NoiseType::Perlin);
+		initial->heightMapNoise[i].SetInterp(FastNoise::Interp::Quintic);
+		initial->heightMapNoise[i].SetFractalOctaves((FN_DECIMAL)(4 - i) * 2);
+		initial->heightMapNoise[i].SetFractalLacunarity((FN_DECIMAL)2);
+		initial->heightMapNoise[i].SetFractalGain((FN_DECIMAL)0.5);
 	}
 	
-	heightMapNoise[0].SetFrequency((FN_DECIMAL)0.005);
-	heightMapNoise[1].SetFrequency((FN_DECIMAL)0.01);
-	heightMapNoise[2].SetFrequency((FN_DECIMAL)0.02);
-	heightMapNoise[3].SetFrequency((FN_DECIMAL)0.04);
-
-	heightMapWeights[0] = .5f;
-	heightMapWeights[1] = .25f;
-	heightMapWeights[2] = .15f;
-	heightMapWeights[3] = .1f;
+	initial->heightMapNoise[0].SetFrequency((FN_DECIMAL)0.005);
+	initial->heightMapNoise[1].SetFrequency((FN_DECIMAL)0.01);
+	initial->heightMapNoise[2].SetFrequency((FN_DECIMAL)0.02);
+	initial->heightMapNoise[3].SetFrequency((FN_DECIMAL)0.04);
+
+	initial->heightMapWeights[0] = .5f;
+	initial->heightMapWeights[1] = .25f;
+	initial->heightMapWeights[2] = .15f;
+	initial->heightMapWeights[3] = .1f;
+	initial->buildKernels();
+
+	config.store(std::move(initial));
+}
+
+void NoiseConfig::buildKernels() {
+	for (int i = 0; i < 4; i++) heightMapKernels[i] = NoiseKernel(heightMapNoise[i], FastNoise::Value);
+
+	// GetValue reads only the seed, frequency and interpolation of each layer
+	heightMapHash = 0xCBF29CE484222325ull;
+	auto mix = [&](const void* data, size_t size) {
+		for (size_t i = 0; i < size; i++) heightMapHash = (heightMapHash ^ ((const unsigned char*)data)[i]) * 0x100000001B3ull;
+	};
+	for (int i = 0; i < 4; i++) {
+		int seed = heightMapNoise[i].GetSeed();
+		FN_DECIMAL frequency = heightMapNoise[i].GetFrequency();
+		int interp = heightMapNoise[i].GetInterp();
+		mix(&seed, sizeof(seed));
+		mix(&frequency, sizeof(frequency));
+		mix(&interp, sizeof(interp));
+		mix(&heightMapWeights[i], sizeof(heightMapWeights[i]));
+	}
 }
 
-int ProcGen::generateChunk(std::vector<BlockID>& chunkVec, ChunkUtils::ChunkCoordPair chunkCoordPair, int levelOfDetail) {
-	std::lock_guard<std::mutex> procGenLock(procGenMutex);
-	setLodVariables(levelOfDetail);
-	std::vector<std::vector<float>> hm = getHeightMap(chunkCoordPair);
+int ProcGen::generateChunk(std::vector<BlockID>& chunkVec, ChunkUtils::ChunkCoordPair chunkCoordPair, int levelOfDetail, bool useHeightMapCache) const {
+	// Held for the whole chunk, a new noise state published halfway through can't tear it
+	std::shared_ptr<const NoiseConfig> snapshot = config.load();
+	return generate(*snapshot, useHeightMapCache ? &heightMapCache : nullptr, chunkVec, chunkCoordPair, levelOfDetail);
+}
+
+int ProcGen::generate(const NoiseConfig& noise, HeightMapCache* cache, std::vector<BlockID>& chunkVec, ChunkUtils::ChunkCoordPair chunkCoordPair,
+	int levelOfDetail)
+{
+	LodResolution lod = LodResolution::of(levelOfDetail);
+	const std::vector<float>& hm = getHeightMap(noise, cache, chunkCoordPair, lod, levelOfDetail >= PREFILTER_FROM_LOD);
+
+	return writeColumns(hm, noise.heightAmplitude, lod, chunkVec);
+}
 
+int ProcGen::writeColumns(const std::vector<float>& hm, int heightAmplitude, const LodResolution& lod, std::vector<BlockID>& chunkVec) {
+	const float globalMin = -1.0f; // Minimum possible Perlin noise value
+	const float globalMax = 1.0f;  // Maximum possible Perlin noise value
+	const int layerSize = lod.resolutionXZ * lod.resolutionXZ;
+
+	// Each column is solid below solidCount and dirt from dirtFrom up, in voxels. Stored in layer order so the
+	// layers below can be written front to back
+	thread_local std::vector<int> solidCount, dirtFrom;
+	solidCount.resize(layerSize);
+	dirtFrom.resize(layerSize);
+
+	int highestOccupiedIndex = 0;
+	int stoneTo = lod.resolutionY;	// every column is stone below this, bar the bedrock layer
+	int airFrom = 0;				// and air from this up
+	for (int x = 0; x < lod.resolutionXZ; x++) {
+		for (int z = 0; z < lod.resolutionXZ; z++) {
+			float normalizedHeight = (hm[x * lod.resolutionXZ + z] - globalMin) / (globalMax - globalMin);
+			float convertHeight = normalizedHeight * heightAmplitude;
+			float dirtHeight = convertHeight - 7;
+
+			// worldY <= convertHeight and worldY >= dirtHeight, solved for whole voxels instead of tested per voxel
+			int solid = 0;
+			if (convertHeight >= 0) solid = std::min(lod.resolutionY, (int)std::floor(std::min(convertHeight, (float)ChunkUtils::HEIGHT)) / lod.blockResolution + 1);
+			int dirt = 0;
+			if (dirtHeight > 0) dirt = std::min(lod.resolutionY, ((int)std::ceil(std::min(dirtHeight, (float)ChunkUtils::HEIGHT)) + lod.blockResolution - 1) / lod.blockResolution);
+
+			int column = x + z * lod.resolutionXZ;
+			solidCount[column] = solid;
+			dirtFrom[column] = dirt;
+			stoneTo = std::min(stoneTo, std::min(solid, dirt));
+			airFrom = std::max(airFrom, solid);
+			if (solid > 0) highestOccupiedIndex = std::max(highestOccupiedIndex, lod.flatIndex(x, solid - 1, z));
+		}
+	}
+	stoneTo = std::max(stoneTo, 1);
+	airFrom = std::max(airFrom, stoneTo);
+
+	// Whole layers that are all one block are single fills, only the band the surface passes through (and the bedrock
+	// layer) is decided voxel by voxel, still front to back
+	BlockID* blocks = chunkVec.data();
+	std::fill(blocks + layerSize, blocks + (size_t)stoneTo * layerSize, BlockID::STONE);
+	std::fill(blocks + (size_t)airFrom * layerSize, blocks + (size_t)lod.resolutionY * layerSize, BlockID::AIR);
+
+	auto writeLayer = [&](int y) {
+		BlockID* layer = blocks + (size_t)y * layerSize;
+		for (int column = 0; column < layerSize; column++) {
+			int solid = solidCount[column];
+			BlockID block;
+			if (y >= solid) block = BlockID::AIR;
+			else if (y >= dirtFrom[column]) block = (y == solid - 1) ? BlockID::GRASS : BlockID::DIRT;
+			else block = (y == 0) ? BlockID::BEDROCK : BlockID::STONE;
+			layer[column] = block;
+		}
+	};
+	writeLayer(0);
+	for (int y = stoneTo; y < airFrom; y++) writeLayer(y);
+
+	return highestOccupiedIndex;
+}
+
+int ProcGen::writeColumnsPerVoxel(const std::vector<float>& hm, int heightAmplitude, const LodResolution& lod, std::vector<BlockID>& chunkVec) {
 	const float globalMin = -1.0f; // Minimum possible Perlin noise value
 	const float globalMax = 1.0f;  // Maximum possible Perlin noise value
 	
 	int highestOccupiedIndex = 0;
 
-	for (int x = 0; x < resolutionXZ; x++) {
-		for (int z = 0; z < resolutionXZ; z++) {
-			float normalizedHeight = (hm[x][z] - globalMin) / (globalMax - globalMin);
+	for (int x = 0; x < lod.resolutionXZ; x++) {
+		for (int z = 0; z < lod.resolutionXZ; z++) {
+			float normalizedHeight = (hm[x * lod.resolutionXZ + z] - globalMin) / (globalMax - globalMin);
 			float convertHeight = normalizedHeight * heightAmplitude;
 			int highestIndex = -1;
 
-			for (int y = 0; y < resolutionY; y++) {
-				int index = convert3DCoordinatesToFlatIndex(x, y, z);
-				int worldY = y * blockResolution;
+			for (int y = 0; y < lod.resolutionY; y++) {
+				int index = lod.flatIndex(x, y, z);
+				int worldY = y * lod.blockResolution;
 
 				if (worldY <= convertHeight) {
 					if (worldY == 0) {
@@ -76,50 +175,197 @@ int ProcGen::generateChunk(std::vector<BlockID>& chunkVec, ChunkUtils::ChunkCoor
 }
 
 
-std::vector<std::vector<float>> ProcGen::getHeightMap(ChunkUtils::ChunkCoordPair chunkCoordPair) {
-	int resolution = ChunkUtils::WIDTH / blockResolution; // resolution is halved for each LOD
-	std::vector<std::vector<float>> heightMap(resolution, std::vector<float>(resolution));
+const std::vector<float>& ProcGen::getHeightMap(const NoiseConfig& noise, HeightMapCache* cache, ChunkUtils::ChunkCoordPair chunkCoordPair,
+	const LodResolution& lod, bool prefiltered)
+{
+	// One set per thread and reused chunk to chunk, all x major. The tile is held until the next call in case the
+	// cache evicts it meanwhile
+	thread_local std::vector<float> layer;
+	thread_local std::vector<float> heightMap;
+	thread_local HeightMapTile tile;
 
-	int chunkX = chunkCoordPair.first;
-	int chunkZ = chunkCoordPair.second;
+	int originX = chunkCoordPair.first * ChunkUtils::WIDTH;
+	int originZ = chunkCoordPair.second * ChunkUtils::DEPTH;
+	int resolution = lod.resolutionXZ; // resolution is halved for each LOD
+	int blockResolution = lod.blockResolution;
+
+	if (prefiltered) {
+		// One sample per column at the centre of the samples it covers. A layer whose lattice is finer than the
+		// column would only average out to noise around zero, so it is skipped rather than evaluated
+		heightMap.assign(resolution * resolution, 0.0f);
+		float centre = (blockResolution - 1) * 0.5f;
+		for (int i = 0; i < 4; i++) {
+			if (noise.heightMapNoise[i].GetFrequency() * blockResolution > 1.0f) continue;
+			layer.resize(resolution * resolution);
+			noise.heightMapKernels[i].fillGrid(layer.data(), originX, originZ, blockResolution, resolution, resolution, centre);
+			for (int c = 0; c < resolution * resolution; c++) heightMap[c] += noise.heightMapWeights[i] * layer[c];
+		}
+		return heightMap;
+	}
+
+	// Otherwise every level reduces the same full resolution tile, evaluated once per column and noise state
+	const int side = ChunkUtils::WIDTH;
+	tile = cache ? cache->find(chunkCoordPair, noise.heightMapHash) : nullptr;
+	if (!tile) {
+		tile = computeTile(noise, chunkCoordPair);
+		if (cache) cache->insert(chunkCoordPair, noise.heightMapHash, tile);
+	}
+	const std::vector<float>& combined = *tile;
+	if (blockResolution == 1) return combined;
+
+	heightMap.resize(resolution * resolution);
 	for (int x = 0; x < resolution; x++) {
 		for (int z = 0; z < resolution; z++) {
-			// Calculate world-space positions for this heightmap point.
-			int x1 = (x * blockResolution) + (chunkX * ChunkUtils::WIDTH);
-			int z1 = (z * blockResolution) + (chunkZ * ChunkUtils::DEPTH);
-
-			float val;
-			if (blockResolution == 1) {
-				// Simple height calculation with full resolution
-				val = static_cast<float>(heightMapWeights[0] * heightMapNoise[0].GetValue(x1, z1) +
-					heightMapWeights[1] * heightMapNoise[1].GetValue(x1, z1) +
-					heightMapWeights[2] * heightMapNoise[2].GetValue(x1, z1) +
-					heightMapWeights[3] * heightMapNoise[3].GetValue(x1, z1));
-			}
-			else {
-				// For higher LODs, sample multiple points and average them
-				float sum = 0;
-				int numSamples = blockResolution; // Number of samples to take in x and z
-				for (int dx = 0; dx < numSamples; dx++) {
-					for (int dz = 0; dz < numSamples; dz++) {
-						float sampleX = x1 + dx;
-						float sampleZ = z1 + dz;
-						sum += (float)(heightMapWeights[0] * heightMapNoise[0].GetValue(sampleX, sampleZ) +
-							heightMapWeights[1] * heightMapNoise[1].GetValue(sampleX, sampleZ) +
-							heightMapWeights[2] * heightMapNoise[2].GetValue(sampleX, sampleZ) +
-							heightMapWeights[3] * heightMapNoise[3].GetValue(sampleX, sampleZ));
-					}
+			// For higher LODs, average the samples the column covers
+			float sum = 0;
+			int numSamples = blockResolution; // Number of samples to take in x and z
+			for (int dx = 0; dx < numSamples; dx++) {
+				for (int dz = 0; dz < numSamples; dz++) {
+					sum += combined[(x * blockResolution + dx) * side + z * blockResolution + dz];
 				}
-				val = sum / (numSamples * numSamples); // Average the samples
 			}
-
-			heightMap[x][z] = val;
+			heightMap[x * resolution + z] = sum / (numSamples * numSamples); // Average the samples
 		}
 	}
 
 	return heightMap;
 }
 
+HeightMapTile ProcGen::computeTile(const NoiseConfig& noise, ChunkUtils::ChunkCoordPair chunkCoordPair) {
+	thread_local std::vector<float> layer[4];
+	const int side = ChunkUtils::WIDTH;
+	int originX = chunkCoordPair.first * ChunkUtils::WIDTH;
+	int originZ = chunkCoordPair.second * ChunkUtils::DEPTH;
+	for (int i = 0; i < 4; i++) {
+		layer[i].resize(side * side);
+		noise.heightMapKernels[i].fillGrid(layer[i].data(), originX, originZ, 1, side, side);
+	}
+
+	auto combined = std::make_shared<std::vector<float>>(side * side);
+	for (int i = 0; i < side * side; i++) {
+		(*combined)[i] = noise.heightMapWeights[0] * layer[0][i] + noise.heightMapWeights[1] * layer[1][i] +
+			noise.heightMapWeights[2] * layer[2][i] + noise.heightMapWeights[3] * layer[3][i];
+	}
+	return combined;
+}
+
+ProcGenBenchmarkResult ProcGen::benchmark(int maxThreads, int side) const {
+	std::shared_ptr<const NoiseConfig> snapshot = config.load();
+	const int chunks = side * side;
+	const int lod = 0;
+
+	// FNV-1a over each chunk's voxels, the single threaded run is the reference
+	auto hashChunk = [](const std::vector<BlockID>& blocks) {
+		uint64_t hash = 0xCBF29CE484222325ull;
+		for (BlockID block : blocks) hash = (hash ^ (uint64_t)block) * 0x100000001B3ull;
+		return hash;
+	};
+
+	ProcGenBenchmarkResult result = { {}, chunks, 0, NoiseKernel::instructionSet(), 0.0, 0.0, 0.0f, {}, {}, 0.0, 0.0, 0 };
+	std::vector<uint64_t> reference;
+	for (int threadCount = 1; threadCount <= std::max(1, maxThreads); threadCount *= 2) {
+		std::vector<uint64_t> hashes(chunks);
+		std::atomic<int> next{ 0 };
+
+		auto work = [&] {
+			std::vector<BlockID> blocks(ChunkUtils::getChunkLength(lod), BlockID::AIR);
+			for (int i = next++; i < chunks; i = next++) {
+				generate(*snapshot, nullptr, blocks, { i % side - side / 2, i / side - side / 2 }, lod);
+				hashes[i] = hashChunk(blocks);
+			}
+		};
+
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> threads;
+		for (int t = 1; t < threadCount; ++t) threads.emplace_back(work);
+		work();
+		for (auto& thread : threads) thread.join();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		result.runs.push_back({ threadCount, seconds > 0.0 ? chunks / seconds : 0.0 });
+		if (reference.empty()) reference = std::move(hashes);
+		else {
+			for (int i = 0; i < chunks; ++i) if (hashes[i] != reference[i]) ++result.mismatches;
+		}
+	}
+
+	// The noise layers on their own, a chunk's grid at a time
+	const int gridSide = ChunkUtils::WIDTH;
+	std::vector<float> grid(gridSide * gridSide);
+	double scalarNs = 0.0, kernelNs = 0.0;
+	volatile float sink = 0.0f;	// keeps the timed loops from being optimised away
+	for (int i = 0; i < 4; i++) {
+		const FastNoise& layer = snapshot->heightMapNoise[i];
+		result.noiseMaxError = std::max(result.noiseMaxError, NoiseKernel::validate(layer, FastNoise::Value));
+
+		auto start = std::chrono::steady_clock::now();
+		for (int c = 0; c < chunks; ++c) {
+			for (int x = 0; x < gridSide; ++x) {
+				for (int z = 0; z < gridSide; ++z) grid[x * gridSide + z] = layer.GetValue((float)(c * gridSide + x), (float)z);
+			}
+			sink = sink + grid[c % grid.size()];
+		}
+		auto middle = std::chrono::steady_clock::now();
+		for (int c = 0; c < chunks; ++c) {
+			snapshot->heightMapKernels[i].fillGrid(grid.data(), c * gridSide, 0, 1, gridSide, gridSide);
+			sink = sink + grid[c % grid.size()];
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		scalarNs += std::chrono::duration<double, std::nano>(middle - start).count();
+		kernelNs += std::chrono::duration<double, std::nano>(end - middle).count();
+	}
+	double samples = 4.0 * chunks * gridSide * gridSide;
+	result.scalarNsPerSample = scalarNs / samples;
+	result.kernelNsPerSample = kernelNs / samples;
+
+	// Cost per level, and how far the prefiltered levels stray from averaging every sample
+	for (int level = 0; level < ChunkUtils::LOD_COUNT; ++level) {
+		std::vector<BlockID> blocks(ChunkUtils::getChunkLength(level), BlockID::AIR);
+		auto start = std::chrono::steady_clock::now();
+		for (int c = 0; c < chunks; ++c) generate(*snapshot, nullptr, blocks, { c % side - side / 2, c / side - side / 2 }, level);
+		result.lodMicrosPerChunk[level] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / chunks;
+
+		if (level < PREFILTER_FROM_LOD) continue;
+		LodResolution lod = LodResolution::of(level);
+		double error = 0.0;
+		for (int c = 0; c < chunks; ++c) {
+			ChunkUtils::ChunkCoordPair key = { c % side - side / 2, c / side - side / 2 };
+			std::vector<float> averaged = getHeightMap(*snapshot, nullptr, key, lod, false);
+			const std::vector<float>& prefiltered = getHeightMap(*snapshot, nullptr, key, lod, true);
+			for (size_t i = 0; i < averaged.size(); ++i) error += std::fabs(prefiltered[i] - averaged[i]);
+		}
+		// Heights map from [-1, 1] onto [0, heightAmplitude]
+		result.lodHeightError[level] = error * 0.5 * snapshot->heightAmplitude / ((double)chunks * lod.resolutionXZ * lod.resolutionXZ);
+	}
+
+	// The column writer on its own, both ways over the same height maps, checked against each other at every level
+	for (int level = 0; level < ChunkUtils::LOD_COUNT; ++level) {
+		LodResolution lod = LodResolution::of(level);
+		std::vector<BlockID> loopBlocks(ChunkUtils::getChunkLength(level)), spanBlocks(loopBlocks.size());
+		double loopNs = 0.0, spanNs = 0.0;
+		for (int c = 0; c < chunks; ++c) {
+			std::vector<float> heightMap = getHeightMap(*snapshot, nullptr, { c % side - side / 2, c / side - side / 2 }, lod, level >= PREFILTER_FROM_LOD);
+
+			auto start = std::chrono::steady_clock::now();
+			int loopHighest = writeColumnsPerVoxel(heightMap, snapshot->heightAmplitude, lod, loopBlocks);
+			auto middle = std::chrono::steady_clock::now();
+			int spanHighest = writeColumns(heightMap, snapshot->heightAmplitude, lod, spanBlocks);
+			auto end = std::chrono::steady_clock::now();
+
+			loopNs += std::chrono::duration<double, std::nano>(middle - start).count();
+			spanNs += std::chrono::duration<double, std::nano>(end - middle).count();
+			if (loopHighest != spanHighest || loopBlocks != spanBlocks) ++result.writerMismatches;
+		}
+		if (level == 0) {
+			double voxels = (double)chunks * loopBlocks.size();
+			result.loopNsPerVoxel = loopNs / voxels;
+			result.spanNsPerVoxel = spanNs / voxels;
+		}
+	}
+	return result;
+}
+
 void ProcGen::setRandomNoiseState() {
 	std::vector<float> state(21);
 
@@ -141,20 +387,15 @@ void ProcGen::setRandomNoiseState() {
 }
 
 void ProcGen::setNoiseState(std::vector<float> state) {
-
+	auto next = std::make_shared<NoiseConfig>(*config.load());
 	for (int i = 0; i < 4; i++) {
-		heightMapNoise[i].SetFrequency(state[i]);
-		heightMapNoise[i].SetFractalOctaves((int)state[i + 4]);
-		heightMapNoise[i].SetFractalLacunarity(state[i + 8]);
-		heightMapNoise[i].SetFractalGain(state[i + 12]);
-		heightMapWeights[i] = state[i + 16];
+		next->heightMapNoise[i].SetFrequency(state[i]);
+		next->heightMapNoise[i].SetFractalOctaves((int)state[i + 4]);
+		next->heightMapNoise[i].SetFractalLacunarity(state[i + 8]);
+		next->heightMapNoise[i].SetFractalGain(state[i + 12]);
+		next->heightMapWeights[i] = state[i + 16];
 	}
-	heightAmplitude = state[20];
-}
-
-void ProcGen::setLodVariables(int levelOfDetail) {
-	blockResolution = 1 << levelOfDetail;
-	resolutionXZ = ChunkUtils::WIDTH / blockResolution;
-	resolutionY = ChunkUtils::HEIGHT / blockResolution;
+	next->heightAmplitude = state[20];
+	next->buildKernels();
+	config.store(std::move(next));
 }
-
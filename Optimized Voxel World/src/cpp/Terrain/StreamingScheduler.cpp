@@ -0,0 +1,244 @@
+#include "h/Terrain/StreamingScheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+StreamingScheduler::StreamingScheduler()
+	: stopping(false)
+	, nextSequence(0)
+	, origin(0, 0)
+	, forward(0.f, -1.f)
+	, lead(0.f)
+	, region(LoadRegion::empty())
+	, lodSelector{}
+	, wantedCount(0)
+	, sweepAll(false)
+	, cancelledLastFocus(0)
+{
+
+}
+
+StreamingScheduler::~StreamingScheduler() {
+	stop();
+}
+
+void StreamingScheduler::start(Executor exec) {
+	executor = std::move(exec);
+	stopping = false;
+	worker = std::thread(&StreamingScheduler::run, this);
+}
+
+void StreamingScheduler::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	wake.notify_all();
+	if (worker.joinable()) worker.join();
+}
+
+void StreamingScheduler::setFocus(const ChunkUtils::ChunkCoordPair& newOrigin, const glm::vec2& newForward, const glm::vec2& newLead, const LoadRegion& newRegion, const LoadDelta& delta, const LodSelector& newLodSelector, bool all) {
+	size_t newCount = newRegion.count();
+	auto now = std::chrono::steady_clock::now();
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		int shift = std::max(std::abs(newOrigin.first - origin.first), std::abs(newOrigin.second - origin.second));
+		origin = newOrigin;
+		forward = newForward;
+		lead = newLead;
+		region = newRegion;
+		lodSelector = newLodSelector;
+		wantedCount = newCount;
+		sweepAll = sweepAll || all;
+		cancelledLastFocus = 0;
+
+		for (auto it = requestedAt.begin(); it != requestedAt.end();) {
+			if (!region.contains(it->first)) it = requestedAt.erase(it);
+			else ++it;
+		}
+
+		if (all || delta.refill) {
+			leavingKeys.clear();
+			fill.emplace(region);
+			fillStartedAt = now;
+			if (all) requestedAt.clear();
+		}
+		else {
+			leavingKeys.insert(leavingKeys.end(), delta.leaving.begin(), delta.leaving.end());
+			// Rings of the new center closer than the old progress minus the step were all queued already. The entering
+			// strip can still sit inside that, rings are squares and the region is round, so it is queued either way
+			if (fill) fill.emplace(region, fill->getRing() - shift);
+			for (const auto& key : delta.entering) {
+				requestedAt.emplace(key, now);
+				pending[{ key, StreamTask::Stream }] = nextSequence++;
+			}
+			for (const auto& key : delta.lodChanged) pending[{ key, StreamTask::Stream }] = nextSequence++;
+		}
+
+		pending[{ { 0, 0 }, StreamTask::Sweep }] = nextSequence++;
+		rebuildQueue();
+	}
+	wake.notify_one();
+}
+
+void StreamingScheduler::setView(const glm::vec2& newForward, const glm::vec2& newLead) {
+	std::lock_guard<std::mutex> lock(mtx);
+	forward = newForward;
+	lead = newLead;
+	rebuildQueue();
+}
+
+void StreamingScheduler::enqueue(const ChunkUtils::ChunkCoordPair& key, StreamTask task) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (task != StreamTask::Sweep && !region.contains(key)) return;
+		push({ key, task });
+	}
+	wake.notify_one();
+}
+
+bool StreamingScheduler::isWanted(const ChunkUtils::ChunkCoordPair& key) const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return region.contains(key);
+}
+
+bool StreamingScheduler::isIdle() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return pending.empty() && !fill;
+}
+
+bool StreamingScheduler::takeSweep(std::vector<ChunkUtils::ChunkCoordPair>& leaving) {
+	std::lock_guard<std::mutex> lock(mtx);
+	bool all = sweepAll;
+	sweepAll = false;
+	leaving.clear();
+	leaving.swap(leavingKeys);
+	return all;
+}
+
+void StreamingScheduler::requestUnload(const ChunkUtils::ChunkCoordPair& key) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		leavingKeys.push_back(key);
+		push({ { 0, 0 }, StreamTask::Sweep });
+	}
+	wake.notify_one();
+}
+
+int StreamingScheduler::levelOfDetail(const ChunkUtils::ChunkCoordPair& key, int currentLod, bool flat) const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return lodSelector.levelOfDetail(key.first - origin.first, key.second - origin.second, currentLod, flat);
+}
+
+void StreamingScheduler::reportVisible(const ChunkUtils::ChunkCoordPair& key) {
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = requestedAt.find(key);
+	if (it == requestedAt.end()) return;
+
+	timeToVisibleMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - it->second).count());
+	if (timeToVisibleMs.size() > TIME_TO_VISIBLE_SAMPLES) timeToVisibleMs.pop_front();
+	requestedAt.erase(it);
+
+	// How far ahead of the camera terrain on the path of travel shows up, the further the better
+	float leadLength = glm::length(lead);
+	if (leadLength < 0.5f) return;
+	glm::vec2 offset((float)(key.first - origin.first), (float)(key.second - origin.second));
+	float along = glm::dot(offset, lead) / leadLength;
+	float across = std::abs(offset.x * lead.y - offset.y * lead.x) / leadLength;
+	if (along <= 0.f || across > POP_IN_CORRIDOR) return;
+
+	popInAhead.push_back(along);
+	if (popInAhead.size() > TIME_TO_VISIBLE_SAMPLES) popInAhead.pop_front();
+}
+
+StreamingStats StreamingScheduler::getStats() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	StreamingStats stats = { pending.size(), wantedCount, cancelledLastFocus, fill ? fill->getRing() : -1, 0.0, 0.0, 0.f, 0.f };
+	for (double ms : timeToVisibleMs) {
+		stats.avgTimeToVisibleMs += ms;
+		stats.maxTimeToVisibleMs = std::max(stats.maxTimeToVisibleMs, ms);
+	}
+	if (!timeToVisibleMs.empty()) stats.avgTimeToVisibleMs /= timeToVisibleMs.size();
+
+	if (!popInAhead.empty()) stats.minPopInAhead = popInAhead.front();
+	for (float along : popInAhead) {
+		stats.avgPopInAhead += along;
+		stats.minPopInAhead = std::min(stats.minPopInAhead, along);
+	}
+	if (!popInAhead.empty()) stats.avgPopInAhead /= popInAhead.size();
+	return stats;
+}
+
+float StreamingScheduler::score(const TaskKey& task) const {
+	if (task.task == StreamTask::Sweep) return -std::numeric_limits<float>::infinity();
+
+	float s = ChunkLoader::loadPriority((float)(task.key.first - origin.first), (float)(task.key.second - origin.second), forward, lead);
+
+	switch (task.task) {
+	case StreamTask::EditMesh:	return s - 1e6f;	// the player is looking at it
+	case StreamTask::Mesh:		return s + MESH_DELAY;
+	case StreamTask::Relod:		return s + RELOD_DELAY;
+	default:					return s;
+	}
+}
+
+void StreamingScheduler::push(const TaskKey& task) {
+	uint64_t sequence = nextSequence++;
+	pending[task] = sequence;
+	queue.push_back({ score(task), sequence, task });
+	std::push_heap(queue.begin(), queue.end(), LaterFirst{});
+}
+
+void StreamingScheduler::rebuildQueue() {
+	// Every pending task gets exactly one fresh entry, stale ones from earlier pushes disappear with the rebuild
+	queue.clear();
+	queue.reserve(pending.size());
+	for (const auto& [task, sequence] : pending) queue.push_back({ score(task), sequence, task });
+	std::make_heap(queue.begin(), queue.end(), LaterFirst{});
+}
+
+void StreamingScheduler::fillFromSpiral() {
+	// No chunk on ring r is closer than r, and the path term can pull it at most the lead's length forward
+	float leadLength = glm::length(lead);
+	std::vector<ChunkUtils::ChunkCoordPair> ring;
+	while (fill && (queue.empty() || queue.front().score > (float)fill->getRing() - leadLength)) {
+		ring.clear();
+		if (!fill->nextRing(ring)) {
+			fill.reset();
+			break;
+		}
+		for (const auto& key : ring) {
+			requestedAt.emplace(key, fillStartedAt);
+			push({ key, StreamTask::Stream });
+		}
+	}
+}
+
+void StreamingScheduler::run() {
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true) {
+		wake.wait(lock, [this] { return stopping || !queue.empty() || fill; });
+		if (stopping) return;
+
+		fillFromSpiral();
+		if (queue.empty()) continue;
+
+		std::pop_heap(queue.begin(), queue.end(), LaterFirst{});
+		QueueEntry entry = queue.back();
+		queue.pop_back();
+
+		auto it = pending.find(entry.task);
+		if (it == pending.end() || it->second != entry.sequence) continue;
+		pending.erase(it);
+
+		if (entry.task.task != StreamTask::Sweep && !region.contains(entry.task.key)) {
+			++cancelledLastFocus;
+			continue;
+		}
+
+		lock.unlock();
+		executor(entry.task.key, entry.task.task);
+		lock.lock();
+	}
+}
\ No newline at end of file
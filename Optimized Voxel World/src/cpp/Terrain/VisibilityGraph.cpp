@@ -0,0 +1,177 @@
+#include "h/Terrain/VisibilityGraph.h"
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+	const int FACE_DX[6] = { -1, 1, 0, 0, 0, 0 };
+	const int FACE_DY[6] = { 0, 0, -1, 1, 0, 0 };
+	const int FACE_DZ[6] = { 0, 0, 0, 0, -1, 1 };
+}
+
+VisibilityGraph::VisibilityGraph()
+	: revision(0)
+	, stats{}
+{
+
+}
+
+SectionConnectivity VisibilityGraph::computeSection(const std::vector<BlockID>& blocks, int lod, int section) {
+	const int width = ChunkUtils::WIDTH >> lod;
+	const int height = ChunkConnectivity::SECTION_HEIGHT >> lod;
+	const int baseY = section * height;
+	const int volume = width * height * width;
+
+	SectionConnectivity result;
+	result.connects.fill(0);
+
+	// Local index x + z * width + y * width * width, opaque blocks start out as seen so the flood never enters them
+	std::vector<uint8_t> seen(volume, 0);
+	int open = 0;
+	for (int i = 0; i < volume; ++i) {
+		int y = i / (width * width), z = (i / width) % width, x = i % width;
+		BlockID block = blocks[ChunkUtils::flattenChunkCoords(x, baseY + y, z, lod)];
+		if (block != BlockID::AIR && block != BlockID::NONE) seen[i] = 1;
+		else ++open;
+	}
+
+	if (open == 0) return result;
+	if (open == volume) {
+		result.connects.fill(0x3F);
+		return result;
+	}
+
+	std::vector<int> stack;
+	for (int start = 0; start < volume; ++start) {
+		if (seen[start]) continue;
+
+		uint8_t faces = 0;
+		seen[start] = 1;
+		stack.push_back(start);
+		while (!stack.empty()) {
+			int i = stack.back();
+			stack.pop_back();
+			int y = i / (width * width), z = (i / width) % width, x = i % width;
+
+			if (x == 0) faces |= 1 << 0;
+			if (x == width - 1) faces |= 1 << 1;
+			if (y == 0) faces |= 1 << 2;
+			if (y == height - 1) faces |= 1 << 3;
+			if (z == 0) faces |= 1 << 4;
+			if (z == width - 1) faces |= 1 << 5;
+
+			for (int f = 0; f < 6; ++f) {
+				int nx = x + FACE_DX[f], ny = y + FACE_DY[f], nz = z + FACE_DZ[f];
+				if (nx < 0 || ny < 0 || nz < 0 || nx >= width || ny >= height || nz >= width) continue;
+				int n = nx + nz * width + ny * width * width;
+				if (seen[n]) continue;
+				seen[n] = 1;
+				stack.push_back(n);
+			}
+		}
+
+		for (int f = 0; f < 6; ++f) {
+			if ((faces >> f) & 1) result.connects[f] |= faces;
+		}
+	}
+
+	return result;
+}
+
+ChunkConnectivity VisibilityGraph::computeChunk(const std::vector<BlockID>& blocks, int lod) {
+	ChunkConnectivity connectivity;
+	for (int s = 0; s < ChunkConnectivity::SECTIONS; ++s) {
+		connectivity.sections[s] = computeSection(blocks, lod, s);
+	}
+	return connectivity;
+}
+
+void VisibilityGraph::setChunk(const ChunkUtils::ChunkCoordPair& key, const ChunkConnectivity& connectivity) {
+	std::lock_guard<std::mutex> lock(graphMtx);
+	graph[key] = connectivity;
+	++revision;
+}
+
+void VisibilityGraph::updateSection(const ChunkUtils::ChunkCoordPair& key, const std::vector<BlockID>& blocks, int lod, int worldY) {
+	int section = sectionAt(worldY);
+	if (section < 0 || section >= ChunkConnectivity::SECTIONS) return;
+
+	SectionConnectivity connectivity = computeSection(blocks, lod, section);
+
+	std::lock_guard<std::mutex> lock(graphMtx);
+	auto it = graph.find(key);
+	if (it == graph.end()) return;
+	it->second.sections[section] = connectivity;
+	++revision;
+}
+
+void VisibilityGraph::removeChunk(const ChunkUtils::ChunkCoordPair& key) {
+	std::lock_guard<std::mutex> lock(graphMtx);
+	if (graph.erase(key)) ++revision;
+}
+
+uint64_t VisibilityGraph::getRevision() const {
+	std::lock_guard<std::mutex> lock(graphMtx);
+	return revision;
+}
+
+void VisibilityGraph::cull(std::vector<ChunkUtils::ChunkCoordPair>& chunks, const glm::vec3& cameraPos, int renderRadius) {
+	stats = {};
+	stats.candidates = chunks.size();
+	stats.reachable = chunks.size();
+
+	// Above or below the world there's no section to start from
+	int cameraY = (int)std::floor(cameraPos.y);
+	if (renderRadius <= 0 || cameraY < 0 || cameraY >= ChunkUtils::HEIGHT) return;
+
+	int centerX = ChunkUtils::worldToChunkCoord((int)std::floor(cameraPos.x));
+	int centerZ = ChunkUtils::worldToChunkCoord((int)std::floor(cameraPos.z));
+	int side = renderRadius * 2 + 1;
+	auto nodeIndex = [&](int cx, int section, int cz) {
+		return ((cx - centerX + renderRadius) * side + (cz - centerZ + renderRadius)) * ChunkConnectivity::SECTIONS + section;
+	};
+	visited.assign((size_t)side * side * ChunkConnectivity::SECTIONS, 0);
+
+	struct Step {
+		int cx, section, cz;
+		int entry;			// face the walk came in through, -1 for the camera's own section
+		uint8_t travelled;	// directions taken so far
+	};
+	std::vector<Step> queue;
+	queue.push_back({ centerX, sectionAt(cameraY), centerZ, -1, 0 });
+	visited[nodeIndex(centerX, sectionAt(cameraY), centerZ)] = 1;
+
+	{
+		std::lock_guard<std::mutex> lock(graphMtx);
+		for (size_t head = 0; head < queue.size(); ++head) {
+			Step step = queue[head];
+			auto it = graph.find({ step.cx, step.cz });
+			const SectionConnectivity* connectivity = it == graph.end() ? nullptr : &it->second.sections[step.section];
+
+			for (int f = 0; f < 6; ++f) {
+				if ((step.travelled >> (f ^ 1)) & 1) continue;
+				if (step.entry >= 0 && connectivity && !connectivity->connected(step.entry, f)) continue;
+
+				int nx = step.cx + FACE_DX[f], ns = step.section + FACE_DY[f], nz = step.cz + FACE_DZ[f];
+				if (ns < 0 || ns >= ChunkConnectivity::SECTIONS) continue;
+				if (std::abs(nx - centerX) > renderRadius || std::abs(nz - centerZ) > renderRadius) continue;
+
+				uint8_t& seen = visited[nodeIndex(nx, ns, nz)];
+				if (seen) continue;
+				seen = 1;
+				queue.push_back({ nx, ns, nz, f ^ 1, (uint8_t)(step.travelled | (1 << f)) });
+			}
+		}
+	}
+	stats.sectionsVisited = queue.size();
+
+	size_t kept = 0;
+	for (const auto& key : chunks) {
+		bool reached = std::abs(key.first - centerX) > renderRadius || std::abs(key.second - centerZ) > renderRadius;
+		for (int s = 0; s < ChunkConnectivity::SECTIONS && !reached; ++s) {
+			reached = visited[nodeIndex(key.first, s, key.second)] != 0;
+		}
+		if (reached) chunks[kept++] = key;
+	}
+	chunks.resize(kept);
+	stats.reachable = kept;
+}
\ No newline at end of file
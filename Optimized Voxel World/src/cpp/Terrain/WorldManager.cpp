@@ -5,14 +5,27 @@
 WorldManager::WorldManager()
 	: vertexPool(nullptr)
 	, proceduralGenerator(nullptr)
+	, retention(ChunkRetentionCache::DEFAULT_VOXEL_BUDGET, ChunkRetentionCache::DEFAULT_MESH_BUDGET)
+	, bringUpPhase(BringUpPhase::Done)
+	, horizonSeconds(-1.0)
+	, fullDetailSeconds(-1.0)
+	, lastCullInputs{}
+	, skippedCullUpdates(0)
+	, softwareOcclusion(true)
+	, connectivityCulling(true)
 	, camera(nullptr)
 	, updatedRenderChunks(false)
 	, readyForPlayerUpdate(false)
 	, renderRadius(std::numeric_limits<int>::min())
+	, chunks(&reclaimer)
+	, streamForward(0.f, -1.f)
+	, streamLead(0.f)
+	, cameraVelocity(0.f)
+	, lastMotionPos(0.f)
+	, lastMotionTime(-1.0)
 
 {
 	lastFrustumCheck = glfwGetTime();
-	stopAsync.store(false);
 }
 
 bool WorldManager::initialize(ProcGen* pg, VertexPool* vp) {
@@ -26,147 +39,375 @@ bool WorldManager::initialize(ProcGen* pg, VertexPool* vp) {
 	vertexPool = vp;
 	renderer.setVertexPoolPointer(vp);
 
+	streamer.start([this](const ChunkUtils::ChunkCoordPair& key, StreamTask task) { runStreamTask(key, task); });
+
 	return true;
 }
 
 void WorldManager::update() {
+	trackCameraMotion();
+
+	// Only once the pool has copied the mesh in, the upload budget can hold a queued one back for several frames
+	for (const auto& key : vertexPool->takeUploaded()) streamer.reportVisible(key);
+
+	// Turning or changing speed re-ranks the streaming queue so chunks coming into view or onto the path go first
+	glm::vec2 forward = viewForward();
+	glm::vec2 lead = travelLead();
+	if (glm::dot(forward, streamForward) < 0.97f || glm::length(lead - streamLead) > 0.5f) {
+		streamForward = forward;
+		streamLead = lead;
+		streamer.setView(forward, lead);
+	}
+
 	double now = glfwGetTime();
-	if ((now - lastFrustumCheck) >= 0.01) {
-		lastFrustumCheck = now;
+	if ((now - lastFrustumCheck) < 0.01 || renderRadius <= 0) return;
+	lastFrustumCheck = now;
 
-		currentRenderChunks = camera->getVisibleChunks(renderRadius);
+	glm::vec3 cameraPos = camera->getCameraPos();
+	ChunkUtils::ChunkCoordPair center = {
+		ChunkUtils::worldToChunkCoord(static_cast<int>(floor(cameraPos.x))),
+		ChunkUtils::worldToChunkCoord(static_cast<int>(floor(cameraPos.z)))
+	};
+	bool gpuCulling = renderer.usesGpuCulling();
+
+	// The CPU path culls against the view, whose transform version only changes when the view matrix does. The GPU
+	// pass does the frustum test itself, so its list only changes with the load region and, under the connectivity
+	// walk, the section the walk starts from and the graph it walks. Looking around costs nothing there
+	CullInputs inputs = {};
+	inputs.renderRadius = renderRadius;
+	inputs.gpuCulling = gpuCulling;
+	inputs.connectivityCulling = connectivityCulling;
+	inputs.softwareOcclusion = softwareOcclusion;
+	if (!gpuCulling) {
+		inputs.cameraVersion = camera->getTransformVersion();
+		inputs.heightRevision = chunkQuadtree.getRevision();
+	}
+	else {
+		inputs.regionRevision = chunkLoader.getRevision();
+		if (connectivityCulling) {
+			int cameraY = static_cast<int>(floor(cameraPos.y));
+			inputs.sectionX = center.first;
+			inputs.sectionY = cameraY < 0 ? -1 : std::min(VisibilityGraph::sectionAt(cameraY), ChunkConnectivity::SECTIONS);
+			inputs.sectionZ = center.second;
+			inputs.graphRevision = visibilityGraph.getRevision();
+		}
+	}
+	if (inputs == lastCullInputs) {
+		++skippedCullUpdates;
+		return;
+	}
+	lastCullInputs = inputs;
+
+	if (!gpuCulling) {
+		currentRenderChunks = chunkQuadtree.getVisibleChunks(camera->getFrustumPlanes(), center, renderRadius);
+		if (connectivityCulling) visibilityGraph.cull(currentRenderChunks, cameraPos, renderRadius);
+		if (softwareOcclusion) {
+			occlusionCuller.cull(currentRenderChunks, camera->getProjection() * camera->getView(), cameraPos);
+		}
 		renderer.updateRenderChunks(currentRenderChunks);
+		return;
 	}
+
+	// Only the load region, the square's corners can hold buckets the retention cache is keeping for later
+	LoadRegion region = chunkLoader.getRegion();
+	if (!connectivityCulling) {
+		// Nothing to hide beyond the frustum, the pool draws whatever of the region it holds without a list
+		currentRenderChunks.clear();
+		renderer.showAllChunks([region](const ChunkUtils::ChunkCoordPair& key) { return region.contains(key); });
+		return;
+	}
+
+	// The list only hides chunks the connectivity walk can't reach, built from the region's own rows
+	currentRenderChunks.clear();
+	ChunkSpans spans;
+	for (int z = std::max(region.minZ(), center.second - renderRadius); z <= std::min(region.maxZ(), center.second + renderRadius); ++z) {
+		int count = region.rowSpans(z, spans);
+		for (int i = 0; i < count; ++i) {
+			int x0 = std::max(spans[i].first, center.first - renderRadius), x1 = std::min(spans[i].second, center.first + renderRadius);
+			for (int x = x0; x <= x1; ++x) currentRenderChunks.push_back({ x, z });
+		}
+	}
+	visibilityGraph.cull(currentRenderChunks, cameraPos, renderRadius);
+	renderer.updateRenderChunks(currentRenderChunks);
 }
 
 void WorldManager::updateRenderChunks(int originX, int originZ, int renderRadius, bool unloadAll) {
+	bool bringUp = this->renderRadius < 0 || unloadAll;
 	this->renderRadius = renderRadius;
+	vertexPool->setEvictionOrigin({ originX, originZ });
+
+	// Never waits on the worker, the scheduler drops what is no longer wanted and re-ranks the rest in place
+	streamForward = viewForward();
+	streamLead = travelLead();
+	// Rebuilt every move so the bands follow the projection, it only costs anything when they actually change
+	chunkLoader.setLodSelector(LodSelector::fromScreenSpaceError(camera->getProjection()[1][1], WindowDetails::WindowHeight, LodSelector::DEFAULT_MAX_ERROR_PIXELS));
+	LoadDelta delta = chunkLoader.moveTo(originX, originZ, renderRadius, streamLead);
+	streamer.setFocus({ originX, originZ }, streamForward, streamLead, chunkLoader.getRegion(), delta, chunkLoader.getLodSelector(), unloadAll);
+	// The first focus brings the world up, and so does regenerating it. Started once the fill is queued, so the worker
+	// can't find the scheduler idle in between
+	if (bringUp) startBringUp();
+}
 
-	auto loadVector = chunkLoader.getLoadList(originX, originZ, renderRadius);
+glm::vec2 WorldManager::viewForward() const {
+	glm::vec3 front = camera->getCameraFront();
+	glm::vec2 flat(front.x, front.z);
+	float length = glm::length(flat);
+	return length > 1e-4f ? flat / length : glm::vec2(0.f);	// looking straight up or down, no direction is preferred
+}
 
-	if (loadFuture.valid()) {
-		stopAsync.store(true);		// Signal to stop the async task
-		loadFuture.get();			// Wait for the async task to finish
-		stopAsync.store(false);		// Reset the stop flag
+void WorldManager::trackCameraMotion() {
+	double now = glfwGetTime();
+	glm::vec3 position = camera->getCameraPos();
+	if (lastMotionTime >= 0.0 && now > lastMotionTime) {
+		float dt = (float)(now - lastMotionTime);
+		glm::vec2 velocity = glm::vec2(position.x - lastMotionPos.x, position.z - lastMotionPos.z) / dt;
+		// Smoothed over roughly a quarter second so single-frame hitches don't swing the prefetch around
+		cameraVelocity += (velocity - cameraVelocity) * std::min(1.f, dt * 4.f);
 	}
+	lastMotionPos = position;
+	lastMotionTime = now;
+}
 
-	unloadChunks(loadVector, unloadAll);  // Unload before starting a new task
-
-	loadFuture = std::async(std::launch::async, [this, loadVector] {
-		this->loadChunksAsync(loadVector);
-	});
-} 
-
-void WorldManager::loadChunksAsync(const std::vector<std::pair<int, int>>& loadChunks) {
-	for (const auto& key : loadChunks) {
-		if (stopAsync.load()) break;
-
-		int lod = calculateLevelOfDetail(key);
-		if (chunkKeys.find(key) == chunkKeys.end()) {
-			auto newChunk = std::make_unique<Chunk>();
-			newChunk->setChunkCoords(key.first, key.second);
-			newChunk->setWorldReference(this);
-			newChunk->setLodVariables(lod);
-			newChunk->generateChunk(*proceduralGenerator);
-
-			readyForPlayerUpdate = false;
-			{
-				std::unique_lock<std::shared_mutex> worldLock(worldMapMtx);
-				worldMap[key] = std::move(newChunk);
-			}
-			readyForPlayerUpdate = true;
-			chunkKeys.insert(key);
-			insertUnmeshed(key);
-		}
+glm::vec2 WorldManager::travelLead() const {
+	glm::vec2 lead = cameraVelocity / (float)ChunkUtils::WIDTH * ChunkLoader::PREFETCH_SECONDS;
+	// Never reach further ahead than a quarter of the render radius, the prefetched crescent stays small
+	float maxLead = renderRadius > 0 ? renderRadius * 0.25f : 0.f;
+	float length = glm::length(lead);
+	if (length > maxLead) lead *= maxLead / length;
+	return lead;
+}
+
+void WorldManager::runStreamTask(const ChunkUtils::ChunkCoordPair& key, StreamTask task) {
+	switch (task) {
+	case StreamTask::Sweep: {
+		std::vector<ChunkUtils::ChunkCoordPair> leaving;
+		bool all = streamer.takeSweep(leaving);
+		unloadChunks(all, leaving);
+		// Meshes the pool evicted to stay within its budget get another chance now that the origin has moved
+		for (const auto& evicted : vertexPool->takeEvicted()) streamer.enqueue(evicted, StreamTask::Mesh);
+		break;
+	}
+	case StreamTask::Stream:
+		streamChunk(key);
+		break;
+	case StreamTask::Relod:
+		relodChunk(key);
+		break;
+	case StreamTask::Mesh:
+		meshWhenNeighboursReady(key);
+		break;
+	case StreamTask::EditMesh:
+		genChunkMesh(key, false);
+		break;
 	}
+	advanceBringUp();
+}
 
-	for (const auto& key : loadChunks) {
-		if (stopAsync.load()) break;
-
-		if (chunkKeys.find(key) != chunkKeys.end()) {
-			std::unique_lock<std::shared_mutex> worldLock(worldMapMtx);
-			int lod = calculateLevelOfDetail(key);
-			if (worldMap[key]->getCurrentLod() != lod) {
-				worldMap[key]->convertLOD(lod);
-				worldMap[key]->generateChunk(*proceduralGenerator);
-				insertUnmeshed(key);
-
-				insertUnmeshed({ key.first - 1, key.second });
-				insertUnmeshed({ key.first + 1, key.second });
-				insertUnmeshed({ key.first, key.second - 1 });
-				insertUnmeshed({ key.first, key.second + 1 });
-			}
+void WorldManager::startBringUp() {
+	std::lock_guard<std::mutex> lock(bringUpMtx);
+	bringUpStart = std::chrono::steady_clock::now();
+	horizonSeconds = -1.0;
+	fullDetailSeconds = -1.0;
+	bringUpPhase = BringUpPhase::Coarse;
+}
+
+void WorldManager::advanceBringUp() {
+	if (bringUpPhase == BringUpPhase::Done || !streamer.isIdle()) return;
+
+	double elapsed;
+	{
+		std::lock_guard<std::mutex> lock(bringUpMtx);
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - bringUpStart).count();
+		if (bringUpPhase == BringUpPhase::Refining) {
+			fullDetailSeconds = elapsed;
+			bringUpPhase = BringUpPhase::Done;
+			return;
 		}
+		horizonSeconds = elapsed;
+		bringUpPhase = BringUpPhase::Refining;
 	}
 
-	std::unordered_set<ChunkUtils::ChunkCoordPair, ChunkUtils::PairHash> meshedKeys;
-	for (const auto& key : unmeshedKeysOrder) {
-		if (stopAsync.load()) break;
-		if (unmeshedKeysSet.find(key) == unmeshedKeysSet.end()) continue;
-		genChunkMesh(key);
-		meshedKeys.insert(key);
+	// The horizon is complete, now every chunk drawn coarser than it should be is rebuilt, the scheduler runs
+	// the nearest and most in view first
+	for (const auto& key : chunks.keys()) {
+		int currentLod = -1;
+		chunks.read(key, [&](Chunk& chunk) { currentLod = chunk.getCurrentLod(); });
+		if (currentLod >= 0 && calculateLevelOfDetail(key, currentLod) != currentLod) streamer.enqueue(key, StreamTask::Relod);
 	}
+}
 
-	for (const auto& key : meshedKeys) unmeshedKeysSet.erase(key);
+BringUpStats WorldManager::getBringUpStats() const {
+	std::lock_guard<std::mutex> lock(bringUpMtx);
+	return { bringUpPhase, horizonSeconds, fullDetailSeconds,
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - bringUpStart).count() };
+}
 
-	if (unmeshedKeysSet.empty())
-		unmeshedKeysOrder.clear();
+std::unique_ptr<Chunk> WorldManager::generateChunk(const ChunkUtils::ChunkCoordPair& key, int lod) {
+	auto newChunk = std::make_unique<Chunk>();
+	newChunk->setChunkCoords(key.first, key.second);
+	newChunk->setWorldReference(this);
+	newChunk->setLodVariables(lod);
+	newChunk->generateChunk(*proceduralGenerator);
+	return newChunk;
 }
 
-int WorldManager::calculateLevelOfDetail(ChunkUtils::ChunkCoordPair ccp) {
-	glm::vec3 cameraPos = camera->getCameraPos();
-	ChunkUtils::ChunkCoordPair cameraKey = {
-		ChunkUtils::worldToChunkCoord(static_cast<int>(floor(cameraPos.x))),
-		ChunkUtils::worldToChunkCoord(static_cast<int>(floor(cameraPos.z)))
-	};
-	
-	float distance = (float)(sqrt(pow(abs(ccp.first - cameraKey.first), 2) + pow(abs(ccp.second - cameraKey.second), 2)));
-
-	// These values aren't final
-	if (distance <= 10) return 0;
-	else if (distance <= 25) return 1;
-	else if (distance <= 50) return 2;
-	else if (distance <= 70) return 3;
-	else if (distance <= 100) return 4;
-	else if (distance <= 512) return 5;
-	else return 6;
+std::unique_ptr<Chunk> WorldManager::restoreChunk(const ChunkUtils::ChunkCoordPair& key, const RetainedChunk& retained) {
+	auto newChunk = std::make_unique<Chunk>();
+	newChunk->setChunkCoords(key.first, key.second);
+	newChunk->setWorldReference(this);
+	newChunk->setLodVariables(retained.lod);
+	newChunk->restoreBlocks(ChunkRetentionCache::decode(retained.runs, ChunkUtils::getChunkLength(retained.lod)));
+	return newChunk;
 }
 
-void WorldManager::unloadChunks(const std::vector<std::pair<int, int>>& loadChunks, bool all) { // all - unload ALL for regeneration or unload those out of render distance
-	const std::unordered_set<std::pair<int, int>, ChunkUtils::PairHash> keep(loadChunks.begin(), loadChunks.end());
+void WorldManager::retainChunk(const ChunkUtils::ChunkCoordPair& key, std::vector<ChunkUtils::ChunkCoordPair>& releasedMeshes) {
+	ChunkRef chunk = chunks.acquire(key);
+	auto blocks = chunk ? chunk->getSnapshot() : nullptr;
+	if (!blocks) {
+		releasedMeshes.push_back(key);
+		return;
+	}
 
-	std::vector<ChunkUtils::ChunkCoordPair> toDelete;
-	{
-		std::shared_lock<std::shared_mutex> mapRead(worldMapMtx);
-		toDelete.reserve(worldMap.size());
-		if (!all) {
-			for (const auto& kv : worldMap) {
-				if (!keep.count(kv.first)) toDelete.push_back(kv.first);
-			}
+	// The bucket is only worth keeping if it shows what the voxels hold, a relod may still be on its way
+	int lod = chunk->getCurrentLod(), meshLod = -1;
+	size_t meshBytes = vertexPool->bucketBytes(key, &meshLod);
+	if (meshLod != lod) meshBytes = 0;
+	if (!meshBytes) releasedMeshes.push_back(key);
+
+	retention.store(key, lod, *blocks, neighbourLodsOf(key), meshBytes, releasedMeshes);
+}
+
+void WorldManager::streamChunk(const ChunkUtils::ChunkCoordPair& key) {
+	int currentLod = -1;
+	if (chunks.read(key, [&](Chunk& chunk) { currentLod = chunk.getCurrentLod(); })) {
+		// Already drawn at some detail, the rebuild can wait behind chunks that are missing entirely
+		if (calculateLevelOfDetail(key, currentLod) != currentLod) streamer.enqueue(key, StreamTask::Relod);
+		return;
+	}
+
+	int lod = calculateLevelOfDetail(key);
+	// Bringing the world up, a coarse horizon everywhere beats full detail in a small disc
+	if (bringUpPhase == BringUpPhase::Coarse) lod = std::max(lod, BRING_UP_LOD);
+	std::vector<ChunkUtils::ChunkCoordPair> releasedMeshes;
+	auto retained = retention.take(key, lod, releasedMeshes);
+	for (const auto& released : releasedMeshes) vertexPool->freeBucket(released);
+	auto newChunk = retained ? restoreChunk(key, *retained) : generateChunk(key, lod);
+	if (retained && retained->meshBytes) retainedMeshes[key] = retained->neighbourLods;
+
+	readyForPlayerUpdate = false;
+	chunks.insert(key, std::move(newChunk));
+	readyForPlayerUpdate = true;
+
+	// The region may have moved on while this chunk generated, after the sweep that would have caught it
+	if (!streamer.isWanted(key)) {
+		streamer.requestUnload(key);
+		return;
+	}
+
+	streamer.enqueue(key, StreamTask::Mesh);
+	// Neighbours that held their mesh back waiting for this chunk can go now
+	for (const auto& neighbour : neighboursOf(key)) {
+		if (deferredMeshes.erase(neighbour)) streamer.enqueue(neighbour, StreamTask::Mesh);
+	}
+}
+
+void WorldManager::relodChunk(const ChunkUtils::ChunkCoordPair& key) {
+	int currentLod = -1;
+	if (!chunks.read(key, [&](Chunk& chunk) { currentLod = chunk.getCurrentLod(); })) return;
+	int lod = calculateLevelOfDetail(key, currentLod);
+	if (lod == currentLod) return;
+	// Refining waits until the coarse horizon is complete, advanceBringUp queues it then
+	if (bringUpPhase == BringUpPhase::Coarse && lod < currentLod) return;
+
+	// Swapped in once generated, the old chunk stays readable until then and for anyone still holding it after.
+	// Its mesh likewise stays drawn until the new one is uploaded over the same draw slot
+	chunks.insert(key, generateChunk(key, lod));
+
+	genChunkMesh(key);
+	// Faces along the shared edges depend on this chunk's detail level
+	for (const auto& neighbour : neighboursOf(key)) streamer.enqueue(neighbour, StreamTask::Mesh);
+}
+
+void WorldManager::meshWhenNeighboursReady(const ChunkUtils::ChunkCoordPair& key) {
+	if (!chunks.contains(key)) return;
+
+	// Meshing before a wanted neighbour exists would close off the faces along that edge
+	for (const auto& neighbour : neighboursOf(key)) {
+		if (!chunks.contains(neighbour) && streamer.isWanted(neighbour)) {
+			deferredMeshes.insert(key);
+			return;
 		}
-		else {
-			for (const auto& kv : worldMap) toDelete.push_back(kv.first);
+	}
+
+	genChunkMesh(key);
+}
+
+std::array<ChunkUtils::ChunkCoordPair, 4> WorldManager::neighboursOf(const ChunkUtils::ChunkCoordPair& key) {
+	return { {
+		{ key.first - 1, key.second },
+		{ key.first + 1, key.second },
+		{ key.first, key.second - 1 },
+		{ key.first, key.second + 1 }
+	} };
+}
+
+std::array<int, 4> WorldManager::neighbourLodsOf(const ChunkUtils::ChunkCoordPair& key) const {
+	std::array<int, 4> lods;
+	auto neighbours = neighboursOf(key);
+	for (int i = 0; i < 4; ++i) {
+		lods[i] = -1;
+		chunks.read(neighbours[i], [&](Chunk& chunk) { lods[i] = chunk.getCurrentLod(); });
+	}
+	return lods;
+}
+
+int WorldManager::calculateLevelOfDetail(ChunkUtils::ChunkCoordPair ccp, int currentLod) {
+	auto it = flatChunks.find(ccp);
+	return streamer.levelOfDetail(ccp, currentLod, it != flatChunks.end() && it->second);
+}
+
+void WorldManager::unloadChunks(bool all, const std::vector<ChunkUtils::ChunkCoordPair>& leaving) { // all - unload ALL for regeneration or unload those that left the load region
+	std::vector<ChunkUtils::ChunkCoordPair> toDelete;
+	std::vector<ChunkUtils::ChunkCoordPair> releasedMeshes;
+	if (!all) {
+		// Only chunks the load region's deltas reported leaving, a chunk may have come back since
+		toDelete.reserve(leaving.size());
+		for (const auto& key : leaving) {
+			if (chunks.contains(key) && !streamer.isWanted(key)) toDelete.push_back(key);
 		}
 	}
+	else {
+		toDelete = chunks.keys();
+	}
+
+	if (all) {
+		// The generator changed, whatever was kept is stale
+		retention.clear(releasedMeshes);
+		releasedMeshes.insert(releasedMeshes.end(), toDelete.begin(), toDelete.end());
+	}
+	else {
+		for (const auto& key : toDelete) retainChunk(key, releasedMeshes);
+	}
 
 	{
 		std::lock_guard<std::mutex> renderLock(renderBuffersMtx);
+		for (const auto& key : releasedMeshes) vertexPool->freeBucket(key);
 		for (const auto& key : toDelete) {
-			vertexPool->freeBucket(key);
+			occlusionCuller.removeOccluder(key);
+			visibilityGraph.removeChunk(key);
+			chunkQuadtree.removeChunk(key);
+			deferredMeshes.erase(key);
+			flatChunks.erase(key);
+			retainedMeshes.erase(key);
 		}
 	}
 
-	{
-		std::unique_lock<std::shared_mutex> mapWrite(worldMapMtx);
-		if (all) {
-			for (const auto& kv : worldMap) chunkKeys.erase(kv.first);
-			worldMap.clear();
-		}
-		else {
-			for (const auto& key : toDelete) {
-				chunkKeys.erase(key);
-				worldMap.erase(key);
-			}
+	if (all) {
+		chunks.clear();
+	}
+	else {
+		for (const auto& key : toDelete) {
+			chunks.erase(key);
 		}
 	}
 }
@@ -176,11 +417,9 @@ BlockID WorldManager::getBlockAtGlobal(int worldX, int worldY, int worldZ) {
 	int chunkZ = ChunkUtils::worldToChunkCoord(worldZ);
 	std::pair<int, int> chunkKey = { chunkX, chunkZ };
 
-	if (chunkKeys.find(chunkKey) != chunkKeys.end()) {
-		std::shared_lock<std::shared_mutex> worldLock(worldMapMtx);
-		return worldMap[chunkKey]->getBlockAt(worldX, worldY, worldZ);
-	}
-	else return BlockID::NONE;
+	BlockID block = BlockID::NONE;
+	chunks.read(chunkKey, [&](Chunk& chunk) { block = chunk.getBlockAt(worldX, worldY, worldZ); });
+	return block;
 }
 
 BlockID WorldManager::getBlockAtGlobal(int worldX, int worldY, int worldZ, BlockFace face, int sourceLod) {
@@ -188,11 +427,9 @@ BlockID WorldManager::getBlockAtGlobal(int worldX, int worldY, int worldZ, Block
 	int chunkZ = ChunkUtils::worldToChunkCoord(worldZ);
 	std::pair<int, int> chunkKey = { chunkX, chunkZ };
 
-	if (chunkKeys.find(chunkKey) != chunkKeys.end()) {
-		std::shared_lock<std::shared_mutex> worldLock(worldMapMtx);
-		return worldMap[chunkKey]->getBlockAt(worldX, worldY, worldZ, face, sourceLod);
-	}
-	else return BlockID::NONE;
+	BlockID block = BlockID::NONE;
+	chunks.read(chunkKey, [&](Chunk& chunk) { block = chunk.getBlockAt(worldX, worldY, worldZ, face, sourceLod); });
+	return block;
 }
 
 void WorldManager::breakBlock(int worldX, int worldY, int worldZ) {
@@ -200,22 +437,23 @@ void WorldManager::breakBlock(int worldX, int worldY, int worldZ) {
 	int chunkZ = ChunkUtils::worldToChunkCoord(worldZ);
 	ChunkUtils::ChunkCoordPair key = { chunkX, chunkZ };
 
-	if (chunkKeys.find(key) != chunkKeys.end()) {
-		int localX = ChunkUtils::convertWorldCoordToLocalCoord(worldX);
-		int localZ = ChunkUtils::convertWorldCoordToLocalCoord(worldZ);
+	int localX = ChunkUtils::convertWorldCoordToLocalCoord(worldX);
+	int localZ = ChunkUtils::convertWorldCoordToLocalCoord(worldZ);
 
-		{
-			std::unique_lock<std::shared_mutex> worldLock(worldMapMtx);
-			worldMap[key]->breakBlock(localX, worldY, localZ);
-		}
+	ChunkRef chunk = chunks.acquire(key);
+	if (!chunk) return;
+	chunk->breakBlock(localX, worldY, localZ);
+	std::shared_ptr<const std::vector<BlockID>> blocks = chunk->getSnapshot();
+	int lod = chunk->getCurrentLod();
+	if (blocks) visibilityGraph.updateSection(key, *blocks, lod, worldY);
 
-		genChunkMesh(key);
+	// Remeshed on the streaming thread ahead of everything else, never here on the main thread
+	streamer.enqueue(key, StreamTask::EditMesh);
 
-		if (localX == 0)							genChunkMesh({ key.first - 1, key.second });
-		else if (localX == ChunkUtils::WIDTH - 1)	genChunkMesh({ key.first + 1, key.second });
-		if (localZ == 0)							genChunkMesh({ key.first, key.second - 1 });
-		else if (localZ == ChunkUtils::DEPTH - 1)	genChunkMesh({ key.first, key.second + 1 });
-	}
+	if (localX == 0)							streamer.enqueue({ key.first - 1, key.second }, StreamTask::EditMesh);
+	else if (localX == ChunkUtils::WIDTH - 1)	streamer.enqueue({ key.first + 1, key.second }, StreamTask::EditMesh);
+	if (localZ == 0)							streamer.enqueue({ key.first, key.second - 1 }, StreamTask::EditMesh);
+	else if (localZ == ChunkUtils::DEPTH - 1)	streamer.enqueue({ key.first, key.second + 1 }, StreamTask::EditMesh);
 }
 
 void WorldManager::placeBlock(int worldX, int worldY, int worldZ, BlockID blockToPlace) {
@@ -223,56 +461,55 @@ void WorldManager::placeBlock(int worldX, int worldY, int worldZ, BlockID blockT
 	int chunkZ = ChunkUtils::worldToChunkCoord(worldZ);
 	ChunkUtils::ChunkCoordPair key = { chunkX, chunkZ };
 
-	if (chunkKeys.find(key) != chunkKeys.end()) {
-		int localX = ChunkUtils::convertWorldCoordToLocalCoord(worldX);
-		int localZ = ChunkUtils::convertWorldCoordToLocalCoord(worldZ);
+	int localX = ChunkUtils::convertWorldCoordToLocalCoord(worldX);
+	int localZ = ChunkUtils::convertWorldCoordToLocalCoord(worldZ);
 
-		{
-			std::unique_lock<std::shared_mutex> worldLock(worldMapMtx);
-			worldMap[key]->placeBlock(localX, worldY, localZ, blockToPlace);
-		}
+	ChunkRef chunk = chunks.acquire(key);
+	if (!chunk) return;
+	chunk->placeBlock(localX, worldY, localZ, blockToPlace);
+	std::shared_ptr<const std::vector<BlockID>> blocks = chunk->getSnapshot();
+	int lod = chunk->getCurrentLod();
+	if (blocks) visibilityGraph.updateSection(key, *blocks, lod, worldY);
 
-		genChunkMesh(key);
+	// Remeshed on the streaming thread ahead of everything else, never here on the main thread
+	streamer.enqueue(key, StreamTask::EditMesh);
 
-		if (localX == 0)							genChunkMesh({ key.first - 1, key.second });
-		else if (localX == ChunkUtils::WIDTH - 1)	genChunkMesh({ key.first + 1, key.second });
-		if (localZ == 0)							genChunkMesh({ key.first, key.second - 1 });
-		else if (localZ == ChunkUtils::DEPTH - 1)	genChunkMesh({ key.first, key.second + 1 });
-	}
+	if (localX == 0)							streamer.enqueue({ key.first - 1, key.second }, StreamTask::EditMesh);
+	else if (localX == ChunkUtils::WIDTH - 1)	streamer.enqueue({ key.first + 1, key.second }, StreamTask::EditMesh);
+	if (localZ == 0)							streamer.enqueue({ key.first, key.second - 1 }, StreamTask::EditMesh);
+	else if (localZ == ChunkUtils::DEPTH - 1)	streamer.enqueue({ key.first, key.second + 1 }, StreamTask::EditMesh);
 }
 
-void WorldManager::genChunkMesh(ChunkUtils::ChunkCoordPair key) {
-	Chunk* chunk = nullptr;
-	int lod = -1;
-
-	{
-		std::shared_lock<std::shared_mutex> worldLock(worldMapMtx);
-		auto it = worldMap.find(key);
-		if (it == worldMap.end()) return;	// this happens sometimes... How? I'll find out another time...
-
-		chunk = worldMap[key].get();
-		lod = chunk->getCurrentLod();
-	}
-
-	{
-		std::unique_lock<std::shared_mutex> worldLock(worldMapMtx);
-		auto it = worldMap.find(key);
+void WorldManager::genChunkMesh(ChunkUtils::ChunkCoordPair key, bool rebuildConnectivity) {
+	// Held for the whole mesh, so a relod swapping the chunk out underneath can't free it mid-way
+	ChunkRef chunk = chunks.acquire(key);
+	if (!chunk) return;	// this happens sometimes... How? I'll find out another time...
+	int lod = chunk->getCurrentLod();
+
+	// A chunk back from the retention cache can keep its old bucket as long as nothing it was meshed against changed
+	auto retainedMesh = retainedMeshes.find(key);
+	if (retainedMesh != retainedMeshes.end()) {
+		int meshLod = -1;
+		bool reusable = rebuildConnectivity && retainedMesh->second == neighbourLodsOf(key)
+			&& vertexPool->bucketBytes(key, &meshLod) && meshLod == lod;
+		retainedMeshes.erase(retainedMesh);
+
+		auto blocks = chunk->getSnapshot();
+		if (reusable && blocks) {
+			retention.recordMeshHit();
+			// The kept bucket was in the pool as of the last frame, drawn as soon as the chunk is in view
+			streamer.reportVisible(key);
+			updateChunkShape(key, *blocks, lod, true);
+			return;
+		}
 	}
 
 	chunk->startMeshing();
 	chunk->greedyMesh();
 
-	// Release mesh from GPU if it exists
-	vertexPool->freeBucket(key);
-
 	MeshUtils::FaceMeshGraphs greedyMeshes;
-
-	{
-		std::shared_lock<std::shared_mutex> worldLock(worldMapMtx);
-		
-		for (int f = 0; f < toInt(BlockFace::Count); ++f) {
-			greedyMeshes[f] = worldMap[key]->getMeshGraph(static_cast<BlockFace>(f));
-        }
+	for (int f = 0; f < toInt(BlockFace::Count); ++f) {
+		greedyMeshes[f] = chunk->getMeshGraph(static_cast<BlockFace>(f));
 	}
 
 	std::vector<Vertex> verts;
@@ -289,13 +526,27 @@ void WorldManager::genChunkMesh(ChunkUtils::ChunkCoordPair key) {
 		}
 	}
 
-	vertexPool->allocateBucket(key, verts.size() * sizeof(Vertex), inds.size());
-	vertexPool->updateVertices(key, verts.data(), verts.size() * sizeof(Vertex));
-	vertexPool->updateIndices(key, inds.data(), inds.size());
+	vertexPool->uploadBucket(key, lod, std::move(verts), std::move(inds));
 
-	{
-		std::unique_lock<std::shared_mutex> worldLock(worldMapMtx);
-		worldMap[key]->unload();
+	// Block edits come through here too, so the occluder never claims a column that has been dug out
+	if (auto blocks = chunk->getSnapshot()) updateChunkShape(key, *blocks, lod, rebuildConnectivity);
+
+	chunk->unload();
+}
+
+void WorldManager::updateChunkShape(const ChunkUtils::ChunkCoordPair& key, const std::vector<BlockID>& blocks, int lod, bool rebuildConnectivity) {
+	ChunkOccluder occluder = SoftwareOcclusionCuller::buildOccluder(blocks, lod);
+	occlusionCuller.setOccluder(key, occluder);
+	chunkQuadtree.setChunkHeights(key, occluder.minFloor, occluder.top);
+	if (rebuildConnectivity) visibilityGraph.setChunk(key, VisibilityGraph::computeChunk(blocks, lod));
+
+	// Measured once, re-measuring at every level could bounce a chunk between two of them. A coarse level rounds
+	// heights to its voxel size, so that much relief doesn't count against it. Only at the chunk's own level or finer,
+	// a mesh clamped coarser (the bring-up horizon) would pass almost everything as flat
+	if (flatChunks.find(key) == flatChunks.end() && lod <= calculateLevelOfDetail(key, lod)) {
+		bool flat = occluder.top - occluder.minFloor < LodSelector::FLAT_RELIEF_BLOCKS + (1 << lod);
+		flatChunks[key] = flat;
+		if (flat && calculateLevelOfDetail(key, lod) != lod) streamer.enqueue(key, StreamTask::Relod);
 	}
 }
 
@@ -305,9 +556,7 @@ void WorldManager::render() {
 }
 
 std::shared_ptr<const std::vector<BlockID>> WorldManager::tryGetChunkSnapshot(ChunkUtils::ChunkCoordPair key) {
-	std::shared_lock<std::shared_mutex> lock(worldMapMtx, std::try_to_lock);
-	if (!lock.owns_lock()) return {};
-	auto it = worldMap.find(key);
-	if (it == worldMap.end()) return {};
-	return it->second->getSnapshot();
+	std::shared_ptr<const std::vector<BlockID>> snapshot;
+	chunks.read(key, [&](Chunk& chunk) { snapshot = chunk.getSnapshot(); });
+	return snapshot;
 }
\ No newline at end of file
@@ -10,6 +10,13 @@ struct InputEvents {
 	bool toggleDebug = false;
 	bool toggleEntityBoxes = false;
 	bool toggleGravity = false;
+	bool toggleGpuCulling = false;
+	bool toggleCullVerification = false;
+	bool toggleOcclusionCulling = false;
+	bool toggleConnectivityCulling = false;
+	bool runDirectoryStress = false;
+	bool runProcGenBenchmark = false;
+	bool runOcclusionBenchmark = false;
 	int renderRadiusDelta = 0;
 
 	std::map<GLuint, bool> playerStates;
@@ -1,6 +1,7 @@
 #pragma once
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <future>
 
 #include "h/Engine/AppWindow.h"
 #include "h/Engine/InputManager.h"
@@ -59,4 +60,14 @@ private:
 	PostProcessingPass postFX;
 	bool usePostProcessing;
 	bool drawEntityBoxes;
+
+	// Chunk directory stress run in the background, the last result stays on the overlay
+	std::future<ChunkDirectoryStressResult> directoryStress;
+	ChunkDirectoryStressResult lastDirectoryStress;
+	// Generation throughput across thread counts, likewise
+	std::future<ProcGenBenchmarkResult> procGenBenchmark;
+	ProcGenBenchmarkResult lastProcGenBenchmark;
+	// CPU occlusion culling on generated terrain from fixed poses, likewise
+	std::future<SoftwareCullBenchmarkResult> occlusionBenchmark;
+	SoftwareCullBenchmarkResult lastOcclusionBenchmark;
 };
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include <array>
 #include <vector>
 #include <map>
+#include <cstdint>
 
 class Camera {
 public:
@@ -29,13 +30,17 @@ public:
 	glm::vec3 getCameraUp() const { return cameraUp; }
 	glm::mat4 getProjection() const { return projection; }
 	glm::mat4 getView() const { return view; }
-	std::vector<std::pair<int, int>> getVisibleChunks(int renderDistance);
+	std::array<glm::vec4, 6> getFrustumPlanes() const { return calculateFrustumPlanes(); }
+	// Changes whenever update() produces a different view, anything derived from the frustum can be cached against it
+	uint64_t getTransformVersion() const { return transformVersion; }
+
+	// Normalised right, left, top, bottom, far, near planes of a projection * view matrix
+	static std::array<glm::vec4, 6> extractFrustumPlanes(const glm::mat4& viewProjection);
 
 private:
-	bool isChunkVisible(const std::pair<int, int>& chunkCoord, const std::array<glm::vec4, 6>& planes) const;
 	std::array<glm::vec4, 6> calculateFrustumPlanes() const;
 
-	std::array<glm::vec4, 6> frustumPlanes;
+	uint64_t transformVersion = 0;
 	glm::vec3 cameraPos; // The point in 3D space at which the camera resides
 	glm::vec3 cameraFront; // The direction the camera is facing.
 	glm::vec3 cameraUp; // The up direction vector. It never changes.
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "h/Rendering/Shader.h"
+#include "h/Rendering/VertexPool.h"
+#include <glad/glad.h>
+#include <h/external/glm/glm.hpp>
+
+#include <array>
+#include <vector>
+
+struct ChunkCullStats {
+    size_t candidates;          // draw slots tested last frame
+    size_t inFrustum;           // the counters below are read back a few frames late
+    size_t drawn;
+    size_t occluded;
+    size_t trianglesSaved;      // triangles of occluded slots that weren't drawn in phase 1 either
+    size_t mismatches;          // slots where the last verified frame disagreed with the CPU reference
+    bool occlusion;
+    bool verified;
+};
+
+// Culls every draw slot of the vertex pool in compute passes and draws the survivors with
+// glMultiDrawElementsIndirectCount, so the visible list never touches the CPU.
+//
+// With a depth source set, culling is two-phase: cull/draw submits the slots that were visible last frame,
+// then cullOccluded builds a Hi-Z pyramid from that depth, tests every slot against it and
+// drawDisoccluded submits whatever became visible. Nothing visible this frame is ever skipped.
+class ChunkCuller {
+public:
+    ChunkCuller();
+
+    bool initialize();
+    void destroy();
+
+    // Depth texture the scene is drawn into, 0 turns occlusion off (e.g. rendering to the default framebuffer)
+    void setDepthSource(GLuint depthTexture, int width, int height);
+    void toggleOcclusion() { occlusionWanted_ = !occlusionWanted_; }
+    bool occlusionActive() const { return occlusionWanted_ && depthSource_ != 0; }
+
+    // Call after VertexPool::beginFrame so the slot buffers are current
+    void cull(const VertexPool& pool, const std::array<glm::vec4, 6>& planes, const glm::mat4& viewProjection);
+    void draw() const;
+    void cullOccluded();
+    void drawDisoccluded() const;
+    void endFrame();
+
+    // Reads the GPU draw lists back every frame and compares them with cullOnCpu, slow but exact
+    void setVerification(bool enabled) { verify_ = enabled; }
+    bool verification() const { return verify_; }
+
+    ChunkCullStats getStats() const;
+
+    enum class Visibility { Outside, Inside, Ambiguous };
+    // CPU reference for one slot, same frustum test as ChunkCull.shader. Boxes within a small distance
+    // of a plane are Ambiguous, float rounding on the GPU may legitimately go either way
+    static Visibility cullOnCpu(const DrawElementsIndirectCommand& cmd, const SlotBounds& bounds, const std::array<glm::vec4, 6>& planes);
+
+private:
+    // Mirrors the CullCounters block in ChunkCull.shader
+    struct CullCounters {
+        GLuint drawCounts[2];
+        GLuint frustumPassed;
+        GLuint occluded;
+        GLuint occludedTriangles;
+        GLuint padding[3];
+    };
+
+    void dispatchCull(GLuint phase);
+    void buildHiZ();
+    void verifyDrawLists();
+
+    static constexpr int READBACK_FRAMES = 3;
+
+    Shader cullShader_, hiZShader_;
+    GLuint drawBuf_, countBuf_, visibilityBuf_, readbackBuf_;
+    size_t drawCapacity_;
+    CullCounters* readback_;
+    std::array<GLsync, READBACK_FRAMES> readbackFences_;
+    int readbackFrame_;
+    CullCounters lastCounters_;
+
+    GLuint depthSource_;
+    int depthWidth_, depthHeight_;
+    GLuint hiZ_;
+    int hiZWidth_, hiZHeight_, hiZLevels_;
+    bool occlusionWanted_;
+
+    const VertexPool* pool_;
+    std::array<glm::vec4, 6> planes_;
+    glm::mat4 viewProjection_;
+    GLuint slots_;
+
+    size_t mismatches_;
+    bool verify_;
+    bool verified_;
+};
\ No newline at end of file
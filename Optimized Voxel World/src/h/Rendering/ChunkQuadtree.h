@@ -0,0 +1,71 @@
+#pragma once
+
+#include "h/Terrain/Utility/ChunkUtils.h"
+#include <h/external/glm/glm.hpp>
+
+#include <array>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <unordered_map>
+
+struct ChunkQuadtreeStats {
+    size_t nodesTested;
+    size_t leafBatches;         // SSE tests of up to four chunks
+    size_t acceptedWhole;       // chunks accepted because a whole subtree was inside
+    size_t visible;
+};
+
+// Frustum culling over the chunk columns that have a mesh. Level 0 holds each chunk's solid height range and
+// every level above covers 2x2 nodes of the one below with their combined range, so a subtree entirely outside
+// (or inside) the frustum is settled with one box test. Leaves of 4x4 chunks are tested four at a time with SSE.
+class ChunkQuadtree {
+public:
+    ChunkQuadtree();
+
+    // Any thread
+    void setChunkHeights(const ChunkUtils::ChunkCoordPair& key, int minY, int maxY);
+    void removeChunk(const ChunkUtils::ChunkCoordPair& key);
+    // Bumped by every change above, a visible list computed at the same revision and camera is still valid
+    uint64_t getRevision() const;
+
+    // Chunks within renderRadius of center (square, like the load list's bounds) whose box touches the frustum
+    std::vector<ChunkUtils::ChunkCoordPair> getVisibleChunks(const std::array<glm::vec4, 6>& planes, const ChunkUtils::ChunkCoordPair& center, int renderRadius);
+
+    ChunkQuadtreeStats getStats() const { return stats_; }
+
+    static constexpr int LEAF_LEVEL = 2;
+    static constexpr int LEVELS = 11;       // top nodes span 1024 chunks, a render radius of 512 needs no more than four
+
+private:
+    struct NodeBounds {
+        int minY, maxY;
+        int chunks;             // chunks with heights beneath this node
+    };
+    enum class Containment { Outside, Inside, Intersecting };
+
+    // PairHash collides badly on dense grids of small coordinates, which is every level of this tree
+    struct NodeHash {
+        size_t operator()(const ChunkUtils::ChunkCoordPair& p) const {
+            uint64_t packed = ((uint64_t)(uint32_t)p.first << 32) | (uint32_t)p.second;
+            return (size_t)((packed * 0x9E3779B97F4A7C15ull) >> 17);
+        }
+    };
+
+    struct Region {
+        int minX, minZ, maxX, maxZ;     // inclusive chunk coordinates of the render square
+    };
+
+    void refreshParents(const ChunkUtils::ChunkCoordPair& key);
+    Containment classify(int level, int nodeX, int nodeZ, const NodeBounds& bounds, const Region& region) const;
+    void cullNode(int level, int nodeX, int nodeZ, const Region& region, std::vector<ChunkUtils::ChunkCoordPair>& out);
+    void acceptNode(int level, int nodeX, int nodeZ, const Region& region, std::vector<ChunkUtils::ChunkCoordPair>& out);
+    void cullLeaf(int nodeX, int nodeZ, const Region& region, std::vector<ChunkUtils::ChunkCoordPair>& out);
+
+    mutable std::mutex treeMtx_;
+    std::array<std::unordered_map<ChunkUtils::ChunkCoordPair, NodeBounds, NodeHash>, LEVELS> levels_;
+    uint64_t revision_;
+
+    std::array<glm::vec4, 6> planes_;
+    ChunkQuadtreeStats stats_;
+};
\ No newline at end of file
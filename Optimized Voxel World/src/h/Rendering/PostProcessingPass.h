@@ -18,11 +18,17 @@ public:
 	void setEnabled(bool on) { use_ = on; }
 	bool enabled() const { return use_; }
 
+	// Scene depth, a texture so later passes can sample it
+	GLuint depthTexture() const { return depth_; }
+	int width() const { return width_; }
+	int height() const { return height_; }
+
 	void destroy();
 
 private:
 	Shader shader_;
-	GLuint fbo_, color_, rbo_;
+	GLuint fbo_, color_, depth_;
+	int width_, height_;
 	GLuint vao_, vbo_;
 	bool use_;
 };
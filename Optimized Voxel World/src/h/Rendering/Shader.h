@@ -19,6 +19,9 @@ public:
 	void setInt(const std::string& name, int value) const;
 	void setFloat(const std::string& name, float value) const;
 	void setVec3(const std::string& name, glm::vec3& value) const;
+	void setUint(const std::string& name, unsigned int value) const;
+	void setIvec2(const std::string& name, int x, int y) const;
+	void setVec4Array(const std::string& name, const glm::vec4* values, int count) const;
 	void setUniform1i(const std::string& name, int value) const;
 	void setUniform4fv(const std::string& name, glm::mat4& transform) const;
 	void deleteProgram();
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "h/Terrain/Utility/ChunkUtils.h"
+#include "h/Terrain/Utility/BlockID.h"
+#include <h/external/glm/glm.hpp>
+
+#include <array>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+class ProcGen;
+
+// What a chunk's blocks guarantee about its solid interior, in world blocks
+struct ChunkOccluder {
+    static constexpr int CELLS = 4;                         // per side, each cell covers WIDTH / CELLS columns
+    std::array<int, CELLS * CELLS> floors;                  // every column in the cell is solid from y = 0 up to here
+    int minFloor;                                           // nothing below this can be seen
+    int top;                                                // one above the highest solid block
+};
+
+struct SoftwareCullStats {
+    size_t tested;
+    size_t occluded;
+    size_t occluderQuads;
+    double rasterMs;
+    double testMs;
+};
+
+struct SoftwareCullBenchmarkPose {
+    const char* name;
+    glm::vec3 position;
+    size_t tested;          // summed over the views, chunks the frustum kept
+    size_t occluded;
+    double rasterMs;        // per view
+    double testMs;
+};
+
+struct SoftwareCullBenchmarkResult {
+    size_t chunks;          // generated around the origin
+    double generateSeconds;
+    std::vector<SoftwareCullBenchmarkPose> poses;     // surface, valley, underground
+};
+
+// Occlusion culling that runs entirely on the CPU: the solid columns of the chunks nearest the camera are
+// rasterised into a small depth buffer four pixels at a time with SSE, then every chunk the frustum kept is
+// tested against it. Needs no GL context, so it also works where the GPU cull pass can't run.
+class SoftwareOcclusionCuller {
+public:
+    SoftwareOcclusionCuller();
+
+    // Scans a chunk's block vector at the given detail level
+    static ChunkOccluder buildOccluder(const std::vector<BlockID>& blocks, int lod);
+
+    // Any thread
+    void setOccluder(const ChunkUtils::ChunkCoordPair& key, const ChunkOccluder& occluder);
+    void removeOccluder(const ChunkUtils::ChunkCoordPair& key);
+
+    // Removes the chunks of visibleChunks hidden behind terrain, order is kept
+    void cull(std::vector<ChunkUtils::ChunkCoordPair>& visibleChunks, const glm::mat4& viewProjection, const glm::vec3& cameraPos);
+
+    SoftwareCullStats getStats() const { return stats_; }
+
+    // Generates the square of chunks within radius of the origin at the levels the world would pick, then culls it
+    // from a hilltop, the lowest column near the origin and underground, looking along each axis from every one
+    static SoftwareCullBenchmarkResult benchmark(const ProcGen& procGen, int radius);
+
+    static constexpr int BUFFER_WIDTH = 256;                // multiple of 4, one SSE register per four pixels
+    static constexpr int BUFFER_HEIGHT = 144;
+    static constexpr size_t MAX_OCCLUDER_CHUNKS = 96;       // nearest chunks only, far ones cover too few pixels to matter
+
+private:
+    struct ScreenVertex {
+        float x, y;
+        float invW;     // linear in screen space, bigger is closer
+    };
+
+    void rasterizeOccluders(const std::vector<ChunkUtils::ChunkCoordPair>& visibleChunks, const glm::vec3& cameraPos);
+    void rasterizeQuad(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d);
+    void rasterizeTriangle(ScreenVertex v0, ScreenVertex v1, ScreenVertex v2);
+    bool isOccluded(const glm::vec3& lo, const glm::vec3& hi) const;
+    ScreenVertex toScreen(const glm::vec4& clip) const;
+
+    std::vector<float> depth_;
+    glm::mat4 viewProjection_;
+
+    mutable std::mutex occluderMtx_;
+    std::unordered_map<ChunkUtils::ChunkCoordPair, ChunkOccluder, ChunkUtils::PairHash> occluders_;
+
+    SoftwareCullStats stats_;
+};
\ No newline at end of file
@@ -7,8 +7,10 @@
 #include "h/Rendering/Shader.h"
 #include "h/Rendering/Utility/BlockGeometry.h"
 #include "h/Rendering/VertexPool.h"
+#include "h/Rendering/ChunkCuller.h"
 #include <h/external/glm/glm.hpp>
 
+#include <array>
 #include <vector>
 #include <map>
 #include <mutex>
@@ -21,28 +23,44 @@ public:
     bool initialize();
     void render();
     void updateRenderChunks(std::vector<std::pair<int, int>>& renderChunks);
+    // Every resident mesh the filter accepts instead of a list, see VertexPool::setAllVisible
+    void showAllChunks(std::function<bool(const ChunkUtils::ChunkCoordPair&)> filter);
     void cleanup();
     void toggleFillLine();
     void setWindowPointer(GLFWwindow* w);
 	void setVertexPoolPointer(VertexPool* vp);
     void updateShaderUniforms(glm::mat4& view, glm::mat4& projection, glm::vec3& viewPos);
+
+    void toggleGpuCulling() { gpuCulling = !gpuCulling; }
+    bool usesGpuCulling() const { return gpuCulling; }
+    void toggleCullVerification() { chunkCuller.setVerification(!chunkCuller.verification()); }
+    void toggleOcclusionCulling() { chunkCuller.toggleOcclusion(); }
+    void setOcclusionDepth(GLuint depthTexture, int w, int h) { chunkCuller.setDepthSource(depthTexture, w, h); }
+    ChunkCullStats getCullStats() const { return chunkCuller.getStats(); }
 private:
     void setupVertexAttributes();
 
     int width, height;
     bool gl_fill;
+    bool gpuCulling;
 
     glm::vec3 lightPos;
     glm::vec3 lightColor;
 
     GLFWwindow* window;
 	VertexPool* vertexPool;
+    uint32_t boundPoolGeneration;
     Shader terrainShader;
 
     VertexArray vertexArray;
     TextureArray blockTextureArray;
+    ChunkCuller chunkCuller;
+    std::array<glm::vec4, 6> frustumPlanes;
+    glm::mat4 viewProjection;
 
     std::mutex renderMtx;
 
     std::vector<std::pair<int, int>> chunksBeingRendered;
+    std::function<bool(const ChunkUtils::ChunkCoordPair&)> visibleFilter;     // used instead of the list while set
+    bool visibleChunksChanged;
 };
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+// Lock-free multi-producer, single-consumer queue. Producers push onto an intrusive stack with one CAS, the
+// consumer takes the whole stack with one exchange and reverses it, so items come out in push order.
+template<typename T>
+class MpscQueue {
+public:
+    MpscQueue() : head_(nullptr) {}
+    ~MpscQueue() { drain([](T&&) {}); }
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // Any thread
+    void push(T&& value) {
+        Node* node = new Node{ std::move(value), head_.load(std::memory_order_relaxed) };
+        while (!head_.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {}
+    }
+
+    // Consumer thread only, calls fn with every item pushed so far, oldest first
+    template<typename Fn>
+    size_t drain(Fn&& fn) {
+        Node* stack = head_.exchange(nullptr, std::memory_order_acquire);
+
+        Node* ordered = nullptr;
+        while (stack) {
+            Node* next = stack->next;
+            stack->next = ordered;
+            ordered = stack;
+            stack = next;
+        }
+
+        size_t count = 0;
+        while (ordered) {
+            Node* next = ordered->next;
+            fn(std::move(ordered->value));
+            delete ordered;
+            ordered = next;
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    struct Node {
+        T value;
+        Node* next;
+    };
+
+    std::atomic<Node*> head_;
+};
\ No newline at end of file
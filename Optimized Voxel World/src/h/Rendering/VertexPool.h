@@ -2,19 +2,32 @@
 
 #include "h/Rendering/Utility/GLErrorCatcher.h"
 #include "h/Rendering/Utility/BlockGeometry.h"
+#include "h/Rendering/Utility/MpscQueue.h"
 #include "h/Terrain/Utility/ChunkUtils.h"
 #include <glad/glad.h>
 
 #include <unordered_map>
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <deque>
 #include <vector>
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <mutex>
+#include <chrono>
+#include <functional>
 
 struct BucketInfo {
     size_t vertexOffsetBytes;
     size_t vertexSizeBytes;
+    size_t vertexCapacityBytes;     // reserved bytes, including slack for remeshes
     size_t indexOffsetBytes;
     size_t indexCount;
+    size_t indexCapacity;
+    int lod;
+    GLuint slot;                    // persistent draw command slot in the indirect buffer
 };
 
 struct DrawElementsIndirectCommand {
@@ -25,45 +38,211 @@ struct DrawElementsIndirectCommand {
     GLuint baseInstance;
 };
 
+// World-space mesh bounds per draw slot, vec4 so the array matches std430 in ChunkCull.shader
+struct SlotBounds {
+    glm::vec4 minCorner;
+    glm::vec4 maxCorner;
+};
+
+struct VertexPoolStats {
+    size_t budgetBytes;
+    size_t vertexRegionBytes;
+    size_t indexRegionBytes;
+    size_t vertexHighWater;     // end of the last live vertex allocation
+    size_t indexHighWater;      // end of the last live index allocation
+    size_t compactedBytes;      // bytes moved by the compactor last frame
+    size_t inPlacePerMinute;    // remeshes that fit their bucket's capacity
+    size_t relocationsPerMinute;
+    size_t evictionsPerMinute;
+    size_t lodSwapsPerMinute;   // meshes replaced by one at another detail level
+    std::array<size_t, ChunkUtils::LOD_COUNT> lodBytes;     // reserved vertex + index bytes per detail level
+    size_t commandSlots;        // draw commands submitted each frame, visible or not
+    size_t commandUploads;      // slots rewritten last frame
+    size_t uploadedBytes;       // mesh bytes copied into the pool last frame
+    size_t uploads;             // meshes copied last frame
+    size_t waitingUploads;      // meshes held back by the upload budget or a full staging ring
+};
+
 class VertexPool {
 public:
-    VertexPool(size_t totalPoolBytes);
+    // The pool starts small and grows in pages up to budgetBytes, after which it evicts the least important meshes
+    VertexPool(size_t budgetBytes);
     ~VertexPool();
 
     bool initialize();
 
-    bool allocateBucket(const ChunkUtils::ChunkCoordPair& chunkKey, size_t vertexBytes, size_t indexCount);
-
-    void updateVertices(const ChunkUtils::ChunkCoordPair& chunkKey, const void* data, size_t bytes);
-    void updateIndices(const ChunkUtils::ChunkCoordPair& chunkKey, const GLuint* data, size_t count);
+    // Queues a chunk's mesh from any thread without locking; the pool itself is only written by the main thread in
+    // beginFrame. A remesh that fits the existing bucket's capacity is overwritten in place; otherwise a new bucket
+    // with slack is allocated and the old one is retired only after the new mesh is written, so the chunk never
+    // disappears. A newer mesh for the same chunk replaces one still waiting for its turn.
+    void uploadBucket(const ChunkUtils::ChunkCoordPair& chunkKey, int lod, std::vector<Vertex>&& vertices, std::vector<GLuint>&& indices);
 
+    // Any thread, queued behind the chunk's earlier uploads and applied in the next beginFrame
     void freeBucket(const ChunkUtils::ChunkCoordPair& chunkKey);
 
     bool containsBucket(const ChunkUtils::ChunkCoordPair& chunkKey) const;
-
-    void buildIndirectCommands(const std::vector<ChunkUtils::ChunkCoordPair>& visibleChunks);
+    // Pool bytes reserved for the chunk's mesh as of the last beginFrame, 0 without a bucket. lod receives its level
+    size_t bucketBytes(const ChunkUtils::ChunkCoordPair& chunkKey, int* lod = nullptr) const;
+
+    // Main thread, once per frame: reclaims retired ranges, copies queued meshes from the staging ring into the pool
+    // and runs one budgeted compaction step
+    void beginFrame();
+    void setCompactionBudget(size_t bytesPerFrame) { _compactionBudget = bytesPerFrame; }
+    // Waiting meshes are copied nearest the eviction origin first until either budget is spent, at least one tried per frame
+    void setUploadBudget(size_t bytesPerFrame, double msPerFrame) { _uploadBudgetBytes = bytesPerFrame; _uploadBudgetMs = msPerFrame; }
+
+    // Only limits growth, a pool already larger than a lowered budget keeps its buffers
+    void setBudget(size_t budgetBytes);
+    // Chunk the eviction distance is measured from, normally the camera's
+    void setEvictionOrigin(const ChunkUtils::ChunkCoordPair& origin);
+    // Chunks whose mesh was evicted or refused since the last call, to be meshed again later
+    std::vector<ChunkUtils::ChunkCoordPair> takeEvicted();
+    // Chunks whose queued mesh was copied into the pool since the last call, drawn from this frame on
+    std::vector<ChunkUtils::ChunkCoordPair> takeUploaded();
+
+    // Diffs against the previous visible set and only rewrites the slots whose visibility flipped
+    void setVisibleChunks(const std::vector<ChunkUtils::ChunkCoordPair>& visibleChunks);
+    // Shows every bucket the filter accepts, and every one uploaded later, until the next setVisibleChunks. For when
+    // nothing but the GPU frustum test culls, so no list of the whole render square has to be built
+    void setAllVisible(std::function<bool(const ChunkUtils::ChunkCoordPair&)> filter);
+    // One multi-draw over every slot, hidden buckets have an instance count of zero
     void renderIndirect() const;
 
+    VertexPoolStats getStats() const;
+
     GLuint getVBO() const { return _vbo; }
     GLuint getEBO() const { return _ebo; }
     GLuint getIndirectBuf() const { return _indirectBuf; }
+    GLuint getBoundsBuf() const { return _boundsBuf; }
+
+    // Main thread only, these are the CPU copies of the slot buffers as of the last beginFrame
+    GLuint getSlotCount() const { return _slotHigh; }
+    const std::vector<DrawElementsIndirectCommand>& getSlotCommands() const { return _commands; }
+    const std::vector<SlotBounds>& getSlotBounds() const { return _bounds; }
+    // Bumped whenever growth replaces the VBO or EBO, vertex array bindings must be refreshed
+    uint32_t getBufferGeneration() const { return _bufferGeneration; }
 
 private:
+    // offset -> size, kept sorted and coalesced
+    using FreeList = std::map<size_t, size_t>;
+    // offset -> owner, only for allocations with a non-zero size
+    using LiveList = std::map<size_t, ChunkUtils::ChunkCoordPair>;
+
+    struct PendingUpload {
+        ChunkUtils::ChunkCoordPair key;
+        int lod;
+        std::vector<Vertex> vertices;
+        std::vector<GLuint> indices;
+        bool release;           // a freeBucket request rather than a mesh
+    };
+
+    enum class FlushResult {
+        Done,               // written into the pool, or given up and reported evicted
+        WaitingForSpace,    // at the budget, evicted, retired or fragmented space is on its way back
+        StagingFull,        // nothing more fits the staging ring until older frames retire
+    };
+
+    struct RetiredRange {
+        size_t offset;
+        size_t size;
+        bool vertex;
+        uint64_t fenceIndex;    // range is reusable once this fence has signalled
+    };
+
+    static size_t allocateRange(FreeList& freeList, size_t bytes);
+    static void releaseRange(FreeList& freeList, size_t offset, size_t bytes);
+    static size_t highWater(const FreeList& freeList, size_t regionBytes);
+    static size_t withSlack(size_t bytes, size_t granule);
+    static constexpr size_t VERTEX_GRANULE = sizeof(Vertex) * 64;
+    static constexpr size_t INDEX_GRANULE = sizeof(GLuint) * 96;
+    static constexpr size_t STAGING_BYTES = 32 * 1024 * 1024;
+    static constexpr size_t PAGE_BYTES = 16 * 1024 * 1024;
+
+    static size_t eventsInLastMinute(std::deque<std::chrono::steady_clock::time_point>& events);
+
+    void retireRange(size_t offset, size_t bytes, bool vertex);
+    void reclaimRetired();
+    size_t allocateStaging(size_t bytes);
+    FlushResult flushUpload(const PendingUpload& upload);
+    void flushUploads();
+    size_t allocateOrGrow(bool vertex, size_t bytes);
+    bool growRegion(bool vertex, size_t bytes);
+    bool makeRoom(const PendingUpload& upload, size_t vertexBytes, size_t indexBytes, bool needVertex, bool needIndex);
+    bool evictsBefore(const ChunkUtils::ChunkCoordPair& a, int lodA, const ChunkUtils::ChunkCoordPair& b, int lodB) const;
+    void retireBucketRanges(const BucketInfo& bucket);
+    void releaseBucket(std::unordered_map<ChunkUtils::ChunkCoordPair, BucketInfo, ChunkUtils::PairHash>::iterator it);
+
+    GLuint allocateSlot();
+    void releaseSlot(GLuint slot);
+    void markSlotDirty(GLuint slot);
+    void setInstances(const ChunkUtils::ChunkCoordPair& key, GLuint instances);
+    void writeSlot(const BucketInfo& bucket);     // keeps the slot's current instance count
+    void uploadSlotRun(GLuint buffer, const void* data, size_t offset, size_t bytes);
+    void flushCommands();
+    size_t compactRegion(bool vertex, size_t budget);
+    void moveRange(GLuint buffer, size_t src, size_t dst, size_t bytes);
+    void releaseTail(bool vertex);
+
     GLuint _vbo = 0;
     GLuint _ebo = 0;
     GLuint _indirectBuf = 0;
-
-    void* _mapV = nullptr;
-    void* _mapI = nullptr;
-
-    size_t _poolBytes;
+    GLuint _boundsBuf = 0;
+    size_t _slotCapacity = 0;
+    GLuint _scratchBuf = 0;
+    size_t _scratchBytes = 0;
+
+    // Persistently mapped upload ring; the pool buffers themselves are GPU-only
+    GLuint _stagingBuf = 0;
+    void* _mapStaging = nullptr;
+    size_t _stagingHead = 0;
+    size_t _stagingUsed = 0;            // bytes written but not yet known to be consumed by the GPU
+    size_t _stagingThisFrame = 0;
+    std::deque<std::pair<uint64_t, size_t>> _stagingInFlight;   // fence index, bytes released when it signals
+
+    size_t _budgetBytes;
     size_t _vertRegion;
     size_t _idxRegion;
+    uint32_t _bufferGeneration = 0;
+
+    FreeList _freeV, _freeI;
+    LiveList _liveV, _liveI;
+
+    std::deque<RetiredRange> _retired;
+    std::deque<std::pair<uint64_t, GLsync>> _fences;
+    uint64_t _fenceIndex = 1;   // index of the next fence beginFrame will insert
+    uint64_t _completedFence = 0;
+
+    size_t _compactionBudget = 4 * 1024 * 1024;
+    size_t _compactedLastFrame = 0;
+    size_t _releasedTailV = SIZE_MAX, _releasedTailI = SIZE_MAX;
+
+    mutable std::deque<std::chrono::steady_clock::time_point> _inPlaceEvents, _relocationEvents, _evictionEvents, _lodSwapEvents;
+
+    ChunkUtils::ChunkCoordPair _evictionOrigin = { 0, 0 };
+    std::vector<ChunkUtils::ChunkCoordPair> _evicted;
+    std::vector<ChunkUtils::ChunkCoordPair> _uploaded;
 
-    std::vector<std::pair<size_t, size_t>> _freeV, _freeI;
+    MpscQueue<PendingUpload> _pendingUploads;   // filled by any thread, drained by beginFrame
+    // Main thread only, the newest mesh per chunk waiting for upload budget or staging space
+    std::unordered_map<ChunkUtils::ChunkCoordPair, PendingUpload, ChunkUtils::PairHash> _waitingUploads;
+    size_t _uploadBudgetBytes = 8 * 1024 * 1024;
+    double _uploadBudgetMs = 2.0;
+    size_t _uploadedLastFrame = 0;
+    size_t _uploadsLastFrame = 0;
 
     mutable std::mutex _bucketMtx;
     std::unordered_map<ChunkUtils::ChunkCoordPair, BucketInfo, ChunkUtils::PairHash> _buckets;
 
+    // CPU copy of the indirect buffer, dirty slots are copied through the staging ring once per frame so
+    // commands change in GPU order with the buffer contents they point at
     std::vector<DrawElementsIndirectCommand> _commands;
+    std::vector<SlotBounds> _bounds;
+    std::vector<GLuint> _dirtySlots;
+    std::vector<bool> _slotDirty;
+    std::set<GLuint> _freeSlots;
+    GLuint _slotHigh = 0;           // one past the highest slot in use, the draw count
+    size_t _commandUploads = 0;
+
+    std::unordered_set<ChunkUtils::ChunkCoordPair, ChunkUtils::PairHash> _visible;
+    std::function<bool(const ChunkUtils::ChunkCoordPair&)> _visibleFilter;     // set while setAllVisible is in effect, _visible is empty then
 };
\ No newline at end of file
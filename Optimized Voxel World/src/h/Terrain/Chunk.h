@@ -32,7 +32,9 @@ public:
 	std::vector<BlockID> getCurrChunkVec() { return chunkLodMap[detailLevel]; }
 
 	// Procedurally generate chunk and form meshes
-	void generateChunk(ProcGen& proceduralGenerator);
+	void generateChunk(const ProcGen& proceduralGenerator);
+	// Takes voxels kept from an earlier load at the current LOD instead of generating them
+	void restoreBlocks(std::vector<BlockID>&& blocks);
 	void startMeshing();
 	BlockFaceBitmask cullFaces(int blockIndex, std::vector<uint16_t>& neighborCache);
 	void markNeighborsCheck(int neighborIndex, BlockFace face, std::vector<uint16_t>& neighborCache);
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "h/Terrain/Chunk.h"
+#include "h/Terrain/Utility/ChunkUtils.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class ChunkReclaimer;
+
+struct ChunkDirectoryStats {
+	size_t chunks;
+	size_t capacity;
+	uint64_t epoch;
+};
+
+struct ChunkDirectoryStressResult {
+	int readers;
+	double seconds;
+	size_t lookups;
+	double lookupsPerSecond;
+	size_t inserts, erases;
+	size_t errors;				// lookups that came back with another chunk's data
+};
+
+struct ChunkEntry {
+	uint64_t key;
+	std::unique_ptr<Chunk> chunk;
+	std::atomic<uint32_t> refs;	// one for the directory until the entry's grace period ends, one per ChunkRef
+	ChunkReclaimer* reclaimer;	// destroys the chunk once the last reference is gone, null to destroy it in place
+};
+
+// A counted reference to a chunk that stays valid after the directory has dropped the chunk
+class ChunkRef {
+public:
+	ChunkRef() : entry(nullptr) {}
+	ChunkRef(const ChunkRef& other);
+	ChunkRef(ChunkRef&& other) noexcept : entry(other.entry) { other.entry = nullptr; }
+	ChunkRef& operator=(ChunkRef other) noexcept { std::swap(entry, other.entry); return *this; }
+	~ChunkRef();
+
+	Chunk* get() const { return entry ? entry->chunk.get() : nullptr; }
+	Chunk* operator->() const { return get(); }
+	Chunk& operator*() const { return *get(); }
+	explicit operator bool() const { return entry != nullptr; }
+
+private:
+	friend class ChunkDirectory;
+	explicit ChunkRef(ChunkEntry* e) : entry(e) {}
+	ChunkEntry* entry;
+};
+
+// Chunk coordinates to chunks, read from any thread without locks and written by one thread at a time.
+// An open-addressed table of atomic slots: readers probe it inside an epoch and never block or retry, the writer
+// publishes new tables by pointer swap and frees removed chunks and old tables once every reader that might still
+// see them has left its epoch. Chunks needed beyond a single lookup are held through a ChunkRef.
+// With a reclaimer, which must outlive the directory, dropped chunks are destroyed on its thread instead
+class ChunkDirectory {
+public:
+	explicit ChunkDirectory(ChunkReclaimer* reclaimer = nullptr);
+	~ChunkDirectory();
+	ChunkDirectory(const ChunkDirectory&) = delete;
+	ChunkDirectory& operator=(const ChunkDirectory&) = delete;
+
+	// Any thread. fn(Chunk&) runs inside the reader's epoch, it must not block or keep the reference
+	template<typename Fn>
+	bool read(const ChunkUtils::ChunkCoordPair& key, Fn&& fn) const {
+		ReadGuard guard(*this);
+		const ChunkEntry* entry = find(pack(key));
+		if (!entry) return false;
+		fn(*entry->chunk);
+		return true;
+	}
+	ChunkRef acquire(const ChunkUtils::ChunkCoordPair& key) const;
+	bool contains(const ChunkUtils::ChunkCoordPair& key) const;
+	size_t size() const { return live.load(std::memory_order_relaxed); }
+
+	// Writer thread. Replacing a chunk retires the old one, readers holding it keep it until they let go
+	void insert(const ChunkUtils::ChunkCoordPair& key, std::unique_ptr<Chunk> chunk);
+	bool erase(const ChunkUtils::ChunkCoordPair& key);
+	void clear();
+	std::vector<ChunkUtils::ChunkCoordPair> keys() const;
+
+	ChunkDirectoryStats getStats() const;
+
+	// Hammers a private directory with one writer and readerThreads readers for the given time, every lookup checks
+	// that the chunk it got carries the coordinates it asked for
+	static ChunkDirectoryStressResult stressTest(int readerThreads, double seconds);
+
+	static constexpr int MAX_READERS = 64;
+
+private:
+	struct Slot {
+		std::atomic<uint64_t> key;
+		std::atomic<ChunkEntry*> entry;		// null for a removed chunk, the slot stays claimed by its key
+	};
+	struct Table {
+		explicit Table(size_t capacity);
+		size_t mask;
+		int shift;
+		std::unique_ptr<Slot[]> slots;
+		size_t used;						// writer only, slots with a key
+	};
+	struct alignas(64) ReaderSlot {
+		std::atomic<uint64_t> epoch;		// IDLE while the thread is outside a read
+		std::atomic<bool> claimed;
+	};
+	template<typename T>
+	struct Retired {
+		uint64_t epoch;
+		T* item;
+	};
+
+	// Pins the calling thread's epoch for the duration of a read, nests
+	class ReadGuard {
+	public:
+		explicit ReadGuard(const ChunkDirectory& directory);
+		~ReadGuard();
+	private:
+		const ChunkDirectory& directory;
+		int slot;
+	};
+	friend class ReadGuard;
+	friend class ChunkRef;
+
+	static uint64_t pack(const ChunkUtils::ChunkCoordPair& key) { return ((uint64_t)(uint32_t)key.first << 32) | (uint32_t)key.second; }
+	static ChunkUtils::ChunkCoordPair unpack(uint64_t key) { return { (int)(uint32_t)(key >> 32), (int)(uint32_t)key }; }
+	static size_t home(const Table& table, uint64_t key) { return (size_t)((key * 0x9E3779B97F4A7C15ull) >> table.shift); }
+
+	const ChunkEntry* find(uint64_t key) const;
+	int claimReaderSlot() const;
+	void rebuild(size_t capacity);
+	void retireEntry(ChunkEntry* entry);
+	// Moves the epoch on when every pinned reader has caught up, then frees what is two epochs old
+	void collect();
+	static void releaseEntry(ChunkEntry* entry);
+
+	static constexpr uint64_t EMPTY = ((uint64_t)0x80000000u << 32) | 0x80000000u;	// INT_MIN, INT_MIN is never a chunk
+	static constexpr uint64_t IDLE = UINT64_MAX;
+
+	ChunkReclaimer* reclaimer;
+	std::atomic<Table*> table;
+	std::atomic<size_t> live;
+	uint64_t id;						// tells this directory apart in the per-thread reader slot cache
+
+	mutable std::atomic<uint64_t> globalEpoch;
+	mutable ReaderSlot readers[MAX_READERS];
+
+	std::vector<Retired<ChunkEntry>> retiredEntries;
+	std::vector<Retired<Table>> retiredTables;
+};
\ No newline at end of file
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <set>
 #include <unordered_set>
 #include <algorithm>
+#include <cstdint>
+
+#include "h/Terrain/Utility/ChunkUtils.h"
+#include <h/external/glm/glm.hpp>
 
 struct Hash {
 	size_t operator()(const std::pair<int, int>& coord) const {
@@ -11,8 +16,114 @@ struct Hash {
 	}
 };
 
+using ChunkSpans = std::array<std::pair<int, int>, 2>;	// inclusive x ranges of one row, sorted and disjoint
+
+// A disc of chunks clipped to the square of half-width halfExtent around its center
+struct ChunkDisc {
+	int centerX, centerZ;
+	int radiusSquared;		// negative for an empty disc
+	int halfExtent;
+
+	bool contains(int x, int z) const;
+	int rowSpans(int z, ChunkSpans& spans) const;
+};
+
+// The chunks that should be loaded: a disc around the focus chunk plus one around the prefetch lead point.
+// Membership is a couple of multiplies, nothing is stored per chunk
+struct LoadRegion {
+	ChunkDisc focus;
+	ChunkDisc ahead;
+
+	bool contains(const ChunkUtils::ChunkCoordPair& key) const { return focus.contains(key.first, key.second) || ahead.contains(key.first, key.second); }
+	int rowSpans(int z, ChunkSpans& spans) const;
+	int minZ() const;
+	int maxZ() const;
+	// Furthest ring of a spiral around the focus chunk that still touches the region
+	int reach() const;
+	size_t count() const;
+
+	static LoadRegion empty();
+};
+
+// Walks a region outwards from its focus one square ring at a time, so the caller can stop, re-center or
+// interleave other work between rings instead of materialising and sorting the whole region
+class LoadSpiral {
+public:
+	LoadSpiral(const LoadRegion& region, int firstRing = 0);
+
+	bool done() const { return ring > region.reach(); }
+	int getRing() const { return ring; }
+	// Appends the region's chunks on the next ring, false once the spiral has left the region
+	bool nextRing(std::vector<ChunkUtils::ChunkCoordPair>& out);
+
+private:
+	LoadRegion region;
+	int ring;
+};
+
+// What changed between two load regions, each list only holds chunks that actually crossed a boundary
+struct LoadDelta {
+	std::vector<ChunkUtils::ChunkCoordPair> entering;
+	std::vector<ChunkUtils::ChunkCoordPair> leaving;
+	std::vector<ChunkUtils::ChunkCoordPair> lodChanged;		// still loaded, but now in a different detail band
+	bool refill;											// nothing was loaded before, walk the region with a LoadSpiral
+};
+
+// Picks detail levels by screen-space error. Level L's voxels are 2^L blocks, so its surface can stray up to 2^L - 1
+// blocks from full detail, and a chunk takes the coarsest level whose error projects to at most maxErrorPixels.
+// That makes each level a band of distances, wider on larger or narrower-FOV viewports. Flat chunks, whose surface a
+// coarse level barely moves, count FLAT_ERROR_WEIGHT of the error and so go coarse closer in
+struct LodSelector {
+	std::array<int, ChunkUtils::LOD_COUNT - 1> radii;		// outer radius of each level's band, in chunks
+	std::array<int, ChunkUtils::LOD_COUNT - 1> flatRadii;
+	float maxErrorPixels;
+
+	// projectionScale is the projection matrix's [1][1], the cotangent of half the vertical FOV
+	static LodSelector fromScreenSpaceError(float projectionScale, int viewportHeight, float maxErrorPixels);
+
+	int levelOfDetail(int dx, int dz, bool flat) const;
+	// The level a chunk already drawn at currentLod should move to. It only goes coarser once it is LOD_HYSTERESIS
+	// chunks past its band's outer edge and only finer once it is that far inside the finer band, so a camera idling
+	// on a boundary doesn't flip chunks back and forth. A negative currentLod gives the plain level
+	int levelOfDetail(int dx, int dz, int currentLod, bool flat) const;
+	// Every radius at which some chunk's level can change, the inner and outer threshold of each band edge
+	std::vector<int> thresholds() const;
+
+	bool operator==(const LodSelector& other) const { return radii == other.radii && flatRadii == other.flatRadii; }
+
+	static constexpr float DEFAULT_MAX_ERROR_PIXELS = 1.f;
+	static constexpr float FLAT_ERROR_WEIGHT = 0.5f;
+	static constexpr int FLAT_RELIEF_BLOCKS = 8;			// a chunk whose surface spans fewer blocks than this is flat
+	static constexpr int LOD_HYSTERESIS = 2;				// in chunks, each side of a band edge
+};
+
 class ChunkLoader {
 public:
 	ChunkLoader();
-	std::vector<std::pair<int, int>> getLoadList(int worldX, int worldZ, int renderRadius);
+
+	// Moves the tracked region to a new focus. Only the rows the regions cover are visited, and within each row only
+	// the strips where the old and new spans differ, so a one-chunk step costs O(radius) rather than the whole disc.
+	// lead is how far, in chunks, the camera is expected to travel over the next PREFETCH_SECONDS
+	LoadDelta moveTo(int chunkX, int chunkZ, int renderRadius, const glm::vec2& lead);
+	const LoadRegion& getRegion() const { return region; }
+	// Bumped by every move, anything derived from the region is stale once it changes
+	uint64_t getRevision() const { return revision; }
+	// A different selector reports every loaded chunk as lodChanged on the next move
+	void setLodSelector(const LodSelector& selector);
+	const LodSelector& getLodSelector() const { return lodSelector; }
+
+	// Lower loads first. Distance from the focus, stretched up to twice behind the view direction, but chunks near the
+	// path ahead count as close as they are to the path plus part of how far along it they lie
+	static float loadPriority(float dx, float dz, const glm::vec2& forward, const glm::vec2& lead);
+
+	static constexpr float PREFETCH_SECONDS = 1.5f;
+	static constexpr float PATH_TRAVEL_WEIGHT = 0.25f;	// per chunk along the path
+	static constexpr float BEHIND_MOTION_WEIGHT = 0.5f;	// per chunk behind the direction of travel
+
+private:
+	LoadRegion region;
+	uint64_t revision;
+	bool loaded;
+	LodSelector lodSelector;
+	bool lodSelectorChanged;
 };
\ No newline at end of file
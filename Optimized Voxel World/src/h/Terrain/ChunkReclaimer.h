@@ -0,0 +1,41 @@
+#pragma once
+
+#include "h/Terrain/Chunk.h"
+#include "h/Rendering/Utility/MpscQueue.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+struct ChunkReclaimerStats {
+	uint64_t queued;		// handed over but not destroyed yet
+	uint64_t reclaimed;
+	double maxBatchMs;		// longest single pass, time that used to be spent on the thread that unloaded them
+};
+
+// Destroys unloaded chunks on a low-priority thread of its own, so freeing their voxel data never stalls the thread
+// that dropped them. Handing a chunk over is one lock-free push
+class ChunkReclaimer {
+public:
+	ChunkReclaimer();
+	// Destroys whatever is still queued before returning
+	~ChunkReclaimer();
+	ChunkReclaimer(const ChunkReclaimer&) = delete;
+	ChunkReclaimer& operator=(const ChunkReclaimer&) = delete;
+
+	// Any thread
+	void reclaim(std::unique_ptr<Chunk> chunk);
+
+	ChunkReclaimerStats getStats() const;
+
+private:
+	void run();
+
+	MpscQueue<std::unique_ptr<Chunk>> queue;
+	std::atomic<uint64_t> pushed;
+	std::atomic<uint64_t> reclaimed;
+	std::atomic<double> maxBatchMs;
+	std::atomic<bool> stopping;
+	std::thread worker;
+};
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "h/Terrain/Utility/ChunkUtils.h"
+#include "h/Terrain/Utility/BlockID.h"
+
+#include <array>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+struct VoxelRun {
+	uint16_t length;
+	BlockID block;
+};
+
+// A chunk that left the load region, kept so coming back costs a decode instead of the generator and the mesher
+struct RetainedChunk {
+	int lod;
+	std::vector<VoxelRun> runs;				// the voxels in flat index order, edits included
+	std::array<int, 4> neighbourLods;		// in WorldManager::neighboursOf order when it left, -1 where none was loaded
+	size_t meshBytes;						// pool bytes of the bucket kept for it, 0 if it was freed
+
+	size_t voxelBytes() const { return runs.capacity() * sizeof(VoxelRun); }
+};
+
+struct RetentionStats {
+	size_t chunks, voxelBytes, voxelBudget;
+	size_t meshes, meshBytes, meshBudget;
+	size_t hits;		// streamed back in from the cache instead of generated
+	size_t meshHits;	// of those, drawn with the bucket kept for them instead of meshed again
+	size_t misses;
+	double hitRate;
+};
+
+// Least recently unloaded chunks, run-length encoded within a voxel budget. Their pool buckets can be kept too within
+// a separate mesh budget, the caller frees whatever buckets store and take report released. Locked, so the overlay
+// can read the stats while the streaming thread works it
+class ChunkRetentionCache {
+public:
+	ChunkRetentionCache(size_t voxelBudgetBytes, size_t meshBudgetBytes);
+
+	// meshBytes is the size of the chunk's pool bucket if the caller is willing to keep it, 0 otherwise. When the
+	// bucket is not wanted it is reported in releasedMeshes along with any evicted to make room
+	void store(const ChunkUtils::ChunkCoordPair& key, int lod, const std::vector<BlockID>& blocks, const std::array<int, 4>& neighbourLods,
+		size_t meshBytes, std::vector<ChunkUtils::ChunkCoordPair>& releasedMeshes);
+	// Removes and returns the chunk if it was kept at this detail level. One kept at another level is dropped
+	std::optional<RetainedChunk> take(const ChunkUtils::ChunkCoordPair& key, int lod, std::vector<ChunkUtils::ChunkCoordPair>& releasedMeshes);
+	void recordMeshHit();
+	void clear(std::vector<ChunkUtils::ChunkCoordPair>& releasedMeshes);
+
+	RetentionStats getStats() const;
+
+	static std::vector<VoxelRun> encode(const std::vector<BlockID>& blocks);
+	static std::vector<BlockID> decode(const std::vector<VoxelRun>& runs, size_t length);
+
+	static constexpr size_t DEFAULT_VOXEL_BUDGET = 64ull * 1024 * 1024;
+	static constexpr size_t DEFAULT_MESH_BUDGET = 128ull * 1024 * 1024;
+
+private:
+	using LruList = std::list<std::pair<ChunkUtils::ChunkCoordPair, RetainedChunk>>;
+
+	void erase(LruList::iterator it, std::vector<ChunkUtils::ChunkCoordPair>& releasedMeshes);
+	void trim(std::vector<ChunkUtils::ChunkCoordPair>& releasedMeshes);
+
+	mutable std::mutex mtx;
+	LruList lru;				// most recently stored first
+	std::unordered_map<ChunkUtils::ChunkCoordPair, LruList::iterator, ChunkUtils::PairHash> index;
+
+	size_t voxelBudget, meshBudget;
+	size_t voxelBytes, meshBytes, meshes;
+	size_t hits, meshHits, misses;
+};
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "h/Terrain/Utility/ChunkUtils.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+using HeightMapTile = std::shared_ptr<const std::vector<float>>;
+
+struct HeightMapCacheStats {
+	size_t tiles, bytes, budgetBytes;
+	size_t hits, misses;
+	double hitRate;
+};
+
+// Full resolution height map tiles, one per chunk column and noise state, least recently used dropped first once
+// over budget. Locked, any generator thread can share it. A tile handed out stays valid after eviction
+class HeightMapCache {
+public:
+	explicit HeightMapCache(size_t budgetBytes);
+
+	// Null on a miss
+	HeightMapTile find(const ChunkUtils::ChunkCoordPair& key, uint64_t noiseHash);
+	void insert(const ChunkUtils::ChunkCoordPair& key, uint64_t noiseHash, HeightMapTile tile);
+	void clear();
+
+	HeightMapCacheStats getStats() const;
+
+	static constexpr size_t DEFAULT_BUDGET = 32ull * 1024 * 1024;
+
+private:
+	struct TileKey {
+		ChunkUtils::ChunkCoordPair chunk;
+		uint64_t noiseHash;
+		bool operator==(const TileKey& other) const { return chunk == other.chunk && noiseHash == other.noiseHash; }
+	};
+	struct TileKeyHash {
+		size_t operator()(const TileKey& key) const { return ChunkUtils::PairHash{}(key.chunk) ^ (size_t)(key.noiseHash * 0x9E3779B97F4A7C15ull); }
+	};
+	using LruList = std::list<std::pair<TileKey, HeightMapTile>>;
+
+	static size_t tileBytes(const HeightMapTile& tile) { return tile->capacity() * sizeof(float); }
+
+	mutable std::mutex mtx;
+	LruList lru;				// most recently used first
+	std::unordered_map<TileKey, LruList::iterator, TileKeyHash> index;
+
+	size_t budget, bytes;
+	size_t hits, misses;
+};
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "h/external/FastNoise-master/FastNoise.h"
+
+// Evaluates one FastNoise layer over a whole grid of samples at once, several lanes per instruction. Matches the
+// FastNoise getter named by sampler: Value is GetValue, ValueFractal is GetValueFractal and likewise for Perlin.
+// Each noise type, interpolation and fractal combination is its own instantiation, picked once when the kernel is
+// built. Anything else (Billow, RigidMulti, other noise types) falls back to calling FastNoise per sample.
+// Immutable once built, any number of threads can fill grids from the same kernel
+class NoiseKernel {
+public:
+	NoiseKernel();
+	NoiseKernel(const FastNoise& noise, FastNoise::NoiseType sampler);
+
+	// out[x * countZ + z] is the sample at world (originX + x * step + offset, originZ + z * step + offset)
+	void fillGrid(float* out, int originX, int originZ, int step, int countX, int countZ, float offset = 0.0f) const;
+
+	// "AVX2", "SSE2" or "scalar", whichever fillGrid runs on this machine
+	static const char* instructionSet();
+	// Largest absolute difference from FastNoise itself over a few grids around the origin
+	static float validate(const FastNoise& noise, FastNoise::NoiseType sampler);
+
+	// Everything a fill reads, copied out of the FastNoise when the kernel is built
+	struct State {
+		int perm[512];
+		float valueLut[512];	// FastNoise's value table already indexed through perm, valueLut[i] = VAL_LUT[perm[i]]
+		float gradX[512], gradY[512];	// likewise its 2D gradients, through perm12
+		float frequency, lacunarity, gain, fractalBounding;
+		int octaves;
+		FastNoise noise;		// the fallback
+		FastNoise::NoiseType sampler;
+	};
+	using FillFn = void(*)(const State&, float*, int, int, int, int, int, float);
+
+private:
+	State state;
+	FillFn fill;
+};
\ No newline at end of file
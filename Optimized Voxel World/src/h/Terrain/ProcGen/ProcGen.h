@@ -3,34 +3,93 @@
 #include "h/Terrain/Utility/ChunkUtils.h"
 #include "h/Terrain/Utility/BlockID.h"
 #include "h/external/FastNoise-master/FastNoise.h"
+#include "h/Terrain/ProcGen/NoiseKernel.h"
+#include "h/Terrain/ProcGen/HeightMapCache.h"
 #include "h/external/glm/glm.hpp"
 
+#include <array>
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <string>
 #include <set>
 #include <map>
-#include <mutex>
 #include <fstream>
 
+// Everything generation reads, never modified once published. A new noise state is a new config
+struct NoiseConfig {
+	FastNoise heightMapNoise[4];
+	float heightMapWeights[4];
+	int heightAmplitude;
+	NoiseKernel heightMapKernels[4];	// GetValue of each layer a grid at a time, rebuilt by buildKernels
+	uint64_t heightMapHash;				// everything the height map depends on, likewise
+
+	void buildKernels();
+};
+
+// Sampling step and voxel counts for one detail level
+struct LodResolution {
+	int blockResolution;
+	int resolutionXZ, resolutionY;
+
+	static LodResolution of(int levelOfDetail) {
+		int blockResolution = 1 << levelOfDetail;
+		return { blockResolution, ChunkUtils::WIDTH / blockResolution, ChunkUtils::HEIGHT / blockResolution };
+	}
+	int flatIndex(int x, int y, int z) const { return x + (z * resolutionXZ) + (y * resolutionXZ * resolutionXZ); }
+};
+
+struct ProcGenBenchmarkRun {
+	int threads;
+	double chunksPerSecond;
+};
+
+struct ProcGenBenchmarkResult {
+	std::vector<ProcGenBenchmarkRun> runs;	// 1, 2, 4... threads up to the requested count
+	int chunks;								// generated by every run
+	size_t mismatches;						// chunks that came out different from the single threaded run
+	const char* noiseInstructionSet;
+	double scalarNsPerSample, kernelNsPerSample;	// one layer over chunk sized grids, FastNoise against NoiseKernel
+	float noiseMaxError;					// largest difference between the two over every layer
+	std::array<double, ChunkUtils::LOD_COUNT> lodMicrosPerChunk;	// single threaded generation cost at each level
+	std::array<double, ChunkUtils::LOD_COUNT> lodHeightError;		// mean blocks between the prefiltered surface and a full average, 0 below PREFILTER_FROM_LOD
+	double loopNsPerVoxel, spanNsPerVoxel;	// filling full detail chunks from their height maps, voxel by voxel against by spans
+	size_t writerMismatches;				// chunks where the two disagreed, at any level
+};
+
+// Reentrant: any number of threads can generate at once. Each call works from one snapshot of the noise config and
+// its own thread's scratch, so a chunk comes out the same whichever thread builds it and however many run alongside
 class ProcGen {
 public:
 	ProcGen();
-	int generateChunk(std::vector<BlockID>& chunkVector, ChunkUtils::ChunkCoordPair chunkCoordPair, int levelOfDetail);
+	// Benchmarks pass useHeightMapCache false so they neither warm nor evict the tiles the world is using
+	int generateChunk(std::vector<BlockID>& chunkVector, ChunkUtils::ChunkCoordPair chunkCoordPair, int levelOfDetail, bool useHeightMapCache = true) const;
+	// Takes effect from the next chunk started, chunks already generating finish with the config they began with
 	void setNoiseState(std::vector<float> state);
 	void setRandomNoiseState();
-private:
-	std::vector<std::vector<float>> getHeightMap(ChunkUtils::ChunkCoordPair chunkCoordPair);
-	FastNoise heightMapNoise[4];
-	float heightMapWeights[4];
-	int heightAmplitude;
 
-	void setLodVariables(int levelOfDetail);
-	inline int convert3DCoordinatesToFlatIndex(int x, int y, int z) {
-		return x + (z * resolutionXZ) + (y * resolutionXZ * resolutionXZ);
-	}
+	// Generates the same square of chunks with 1, 2, 4... threads up to maxThreads and checks each run against the first
+	ProcGenBenchmarkResult benchmark(int maxThreads, int side) const;
+	HeightMapCacheStats getHeightMapCacheStats() const { return heightMapCache.getStats(); }
 
-	std::mutex procGenMutex;
+	// From this level on the height map is sampled once per column at its centre, with the layers too fine to show
+	// at that voxel size left out, instead of averaging every full resolution sample the column covers
+	static constexpr int PREFILTER_FROM_LOD = 2;
 
-	int blockResolution;
-	int resolutionXZ, resolutionY;
+private:
+	// cache may be null, the benchmark measures generation without it
+	static int generate(const NoiseConfig& noise, HeightMapCache* cache, std::vector<BlockID>& chunkVector, ChunkUtils::ChunkCoordPair chunkCoordPair,
+		int levelOfDetail);
+	// Fills the calling thread's scratch, valid until its next call
+	static const std::vector<float>& getHeightMap(const NoiseConfig& noise, HeightMapCache* cache, ChunkUtils::ChunkCoordPair chunkCoordPair,
+		const LodResolution& lod, bool prefiltered);
+	static HeightMapTile computeTile(const NoiseConfig& noise, ChunkUtils::ChunkCoordPair chunkCoordPair);
+	// Fill chunkVector from the height map and return the highest occupied index. writeColumns solves each column's
+	// block boundaries once and writes layer by layer, writeColumnsPerVoxel is the original loop it is measured against
+	static int writeColumns(const std::vector<float>& heightMap, int heightAmplitude, const LodResolution& lod, std::vector<BlockID>& chunkVector);
+	static int writeColumnsPerVoxel(const std::vector<float>& heightMap, int heightAmplitude, const LodResolution& lod, std::vector<BlockID>& chunkVector);
+
+	std::atomic<std::shared_ptr<const NoiseConfig>> config;
+	// Full resolution tiles shared by every level that averages them and kept across regenerations
+	mutable HeightMapCache heightMapCache;
 };
\ No newline at end of file
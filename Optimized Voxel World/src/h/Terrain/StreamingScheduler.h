@@ -0,0 +1,135 @@
+#pragma once
+
+#include "h/Terrain/Utility/ChunkUtils.h"
+#include "h/Terrain/ChunkLoader.h"
+#include <h/external/glm/glm.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+enum class StreamTask {
+	Sweep,		// unload everything no longer wanted, always first
+	EditMesh,	// remesh after a block edit, connectivity was already updated on the main thread
+	Stream,		// make sure the chunk exists, generating it if it doesn't
+	Mesh,		// mesh a generated chunk
+	Relod,		// regenerate a chunk that exists at the wrong detail level
+};
+
+struct StreamingStats {
+	size_t queued;
+	size_t wanted;
+	size_t cancelledLastFocus;		// queued tasks dropped because the camera moved away from them
+	int fillRing;					// ring the initial spiral fill has reached, -1 once it is done
+	double avgTimeToVisibleMs;		// from a chunk becoming wanted to its mesh being handed to the pool
+	double maxTimeToVisibleMs;
+	float avgPopInAhead;				// chunks between the focus and newly visible chunks on the path of travel
+	float minPopInAhead;
+};
+
+// A persistent worker thread draining a priority queue of chunk tasks. Lower scores run first: the loader's priority
+// for the chunk (distance, view direction and the path of travel), plus a delay per task kind so that missing
+// chunks come before meshes and both come before detail-level changes of chunks that are already drawn.
+// The main thread only ever takes the queue's mutex briefly, it never waits on the worker. A fresh region is not
+// queued up front, the worker pulls it from a LoadSpiral a ring at a time whenever the next ring could outrank the
+// best queued task, so the queue only ever holds the frontier.
+class StreamingScheduler {
+public:
+	using Executor = std::function<void(const ChunkUtils::ChunkCoordPair&, StreamTask)>;
+
+	StreamingScheduler();
+	~StreamingScheduler();
+	StreamingScheduler(const StreamingScheduler&) = delete;
+	StreamingScheduler& operator=(const StreamingScheduler&) = delete;
+
+	void start(Executor executor);
+	// Joins the worker, shutdown only
+	void stop();
+
+	// Main thread: replaces the wanted region and queues Stream tasks for the chunks the delta says entered it or
+	// changed detail band. Queued tasks outside the region are dropped when they reach the front. With sweepAll every
+	// loaded chunk is unloaded first, e.g. after the generator changed, and the region is walked again from the focus.
+	// Detail levels are chosen with lodSelector from then on
+	void setFocus(const ChunkUtils::ChunkCoordPair& origin, const glm::vec2& forward, const glm::vec2& lead, const LoadRegion& region, const LoadDelta& delta, const LodSelector& lodSelector, bool sweepAll);
+	// Main thread: re-scores everything queued in place, cheap enough to call whenever the view turns or the speed changes
+	void setView(const glm::vec2& forward, const glm::vec2& lead);
+
+	// Any thread
+	void enqueue(const ChunkUtils::ChunkCoordPair& key, StreamTask task);
+	bool isWanted(const ChunkUtils::ChunkCoordPair& key) const;
+	// Nothing queued and the spiral fill finished, every wanted chunk has had its turn
+	bool isIdle() const;
+	// For the Sweep task: whether to unload every chunk, otherwise the chunks that left the region since the last
+	// sweep are moved into 'leaving'. Clears both
+	bool takeSweep(std::vector<ChunkUtils::ChunkCoordPair>& leaving);
+	// A chunk that finished generating after the region moved away from it
+	void requestUnload(const ChunkUtils::ChunkCoordPair& key);
+	// Measured from the focus rather than the live camera, which only the main thread may read
+	int levelOfDetail(const ChunkUtils::ChunkCoordPair& key, int currentLod, bool flat) const;
+	void reportVisible(const ChunkUtils::ChunkCoordPair& key);
+
+	StreamingStats getStats() const;
+
+	static constexpr float MESH_DELAY = 1.5f;		// in chunks of distance, lets a chunk's neighbours generate before it meshes
+	static constexpr float RELOD_DELAY = 4.f;
+	static constexpr size_t TIME_TO_VISIBLE_SAMPLES = 256;
+	static constexpr float POP_IN_CORRIDOR = 1.5f;	// chunks either side of the path of travel that count for pop-in
+
+private:
+	struct TaskKey {
+		ChunkUtils::ChunkCoordPair key;
+		StreamTask task;
+		bool operator==(const TaskKey& other) const { return key == other.key && task == other.task; }
+	};
+	struct TaskKeyHash {
+		size_t operator()(const TaskKey& t) const { return ChunkUtils::PairHash{}(t.key) * 8 + (size_t)t.task; }
+	};
+	struct QueueEntry {
+		float score;
+		uint64_t sequence;		// entries whose sequence no longer matches pending are stale
+		TaskKey task;
+	};
+	struct LaterFirst {
+		bool operator()(const QueueEntry& a, const QueueEntry& b) const { return a.score > b.score; }
+	};
+
+	float score(const TaskKey& task) const;
+	void push(const TaskKey& task);
+	void rebuildQueue();
+	// Pushes spiral rings while the next one could hold a better task than the front of the queue
+	void fillFromSpiral();
+	void run();
+
+	mutable std::mutex mtx;
+	std::condition_variable wake;
+	std::thread worker;
+	Executor executor;
+	bool stopping;
+
+	std::vector<QueueEntry> queue;		// binary heap ordered by LaterFirst
+	std::unordered_map<TaskKey, uint64_t, TaskKeyHash> pending;
+	uint64_t nextSequence;
+
+	ChunkUtils::ChunkCoordPair origin;
+	glm::vec2 forward;
+	glm::vec2 lead;
+	LoadRegion region;
+	LodSelector lodSelector;
+	size_t wantedCount;
+	std::optional<LoadSpiral> fill;
+	std::chrono::steady_clock::time_point fillStartedAt;
+	bool sweepAll;
+	std::vector<ChunkUtils::ChunkCoordPair> leavingKeys;
+	size_t cancelledLastFocus;
+
+	std::unordered_map<ChunkUtils::ChunkCoordPair, std::chrono::steady_clock::time_point, ChunkUtils::PairHash> requestedAt;
+	std::deque<double> timeToVisibleMs;
+	std::deque<float> popInAhead;
+};
\ No newline at end of file
@@ -13,6 +13,7 @@ namespace ChunkUtils {
     constexpr int WIDTH = 64;
     constexpr int HEIGHT = 256;
     constexpr int DEPTH = 64;
+    constexpr int LOD_COUNT = 7;    // detail levels 0..6, WIDTH >> 6 is a single voxel
 
     constexpr int worldToChunkCoord(int worldCoord) {
         return (worldCoord >= 0) ? (worldCoord / ChunkUtils::WIDTH) : ((worldCoord - (ChunkUtils::WIDTH - 1)) / ChunkUtils::WIDTH);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "h/Terrain/Utility/ChunkUtils.h"
+#include "h/Terrain/Utility/BlockID.h"
+#include <h/external/glm/glm.hpp>
+
+#include <array>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <unordered_map>
+
+// Which faces of a chunk section can see each other through non-opaque blocks.
+// Faces are indexed -X, +X, -Y, +Y, -Z, +Z, so a face's opposite is face ^ 1
+struct SectionConnectivity {
+	std::array<uint8_t, 6> connects;	// bit b of connects[a] is set when air links face a to face b
+
+	bool connected(int from, int to) const { return (connects[from] >> to) & 1; }
+};
+
+struct ChunkConnectivity {
+	static constexpr int SECTION_HEIGHT = 64;
+	static constexpr int SECTIONS = ChunkUtils::HEIGHT / SECTION_HEIGHT;
+	std::array<SectionConnectivity, SECTIONS> sections;
+};
+
+struct VisibilityGraphStats {
+	size_t candidates;
+	size_t reachable;
+	size_t sectionsVisited;
+};
+
+// Connectivity-graph culling: a breadth-first walk from the camera's section that only crosses a section
+// from the face it was entered through to faces air connects it to, and never heads back towards the camera.
+// Chunks none of whose sections are reached can't be seen from where the camera is, whatever the frustum says.
+class VisibilityGraph {
+public:
+	VisibilityGraph();
+
+	// Flood fills one section of a chunk's block vector at the given detail level
+	static SectionConnectivity computeSection(const std::vector<BlockID>& blocks, int lod, int section);
+	static ChunkConnectivity computeChunk(const std::vector<BlockID>& blocks, int lod);
+	static int sectionAt(int worldY) { return worldY / ChunkConnectivity::SECTION_HEIGHT; }
+
+	// Any thread
+	void setChunk(const ChunkUtils::ChunkCoordPair& key, const ChunkConnectivity& connectivity);
+	// Re-floods only the section holding worldY, for block edits
+	void updateSection(const ChunkUtils::ChunkCoordPair& key, const std::vector<BlockID>& blocks, int lod, int worldY);
+	void removeChunk(const ChunkUtils::ChunkCoordPair& key);
+	// Bumped by every change above, a walk from the same section over the same region is still valid
+	uint64_t getRevision() const;
+
+	// Removes the chunks the walk can't reach, order is kept. Chunks that haven't been meshed yet count as open air
+	void cull(std::vector<ChunkUtils::ChunkCoordPair>& chunks, const glm::vec3& cameraPos, int renderRadius);
+
+	VisibilityGraphStats getStats() const { return stats; }
+
+private:
+	mutable std::mutex graphMtx;
+	std::unordered_map<ChunkUtils::ChunkCoordPair, ChunkConnectivity, ChunkUtils::PairHash> graph;
+	uint64_t revision;
+
+	std::vector<uint8_t> visited;		// per section of the render square, reused between walks
+	VisibilityGraphStats stats;
+};
\ No newline at end of file
@@ -1,14 +1,32 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <unordered_map>
 #include <set>
-#include <future>
-#include <shared_mutex>
 
 #include "h/Terrain/Chunk.h"
 #include "h/Terrain/ChunkLoader.h"
+#include "h/Terrain/VisibilityGraph.h"
+#include "h/Terrain/StreamingScheduler.h"
+#include "h/Terrain/ChunkDirectory.h"
+#include "h/Terrain/ChunkReclaimer.h"
+#include "h/Terrain/ChunkRetentionCache.h"
 #include "h/Rendering/Camera.h"
 #include "h/Rendering/TerrainRenderer.h"
+#include "h/Rendering/SoftwareOcclusionCuller.h"
+#include "h/Rendering/ChunkQuadtree.h"
+
+enum class BringUpPhase { Coarse, Refining, Done };
+
+struct BringUpStats {
+    BringUpPhase phase;
+    double horizonSeconds;      // until every chunk in the radius was drawn at some level, -1 until then
+    double fullDetailSeconds;   // until every chunk reached its own level, -1 until then
+    double elapsedSeconds;
+};
 
 class WorldManager {
 public:
@@ -20,7 +38,7 @@ public:
 
     void update();
     void render();
-    void cleanup() { renderer.cleanup(); }
+    void cleanup() { streamer.stop(); renderer.cleanup(); }
 
     void updateRenderChunks(int originX, int originZ, int renderRadius, bool unloadAll);
 
@@ -33,46 +51,123 @@ public:
     void passCameraPointer(Camera* cam) { camera = cam; }
     bool getReadyForPlayerUpdate() { return readyForPlayerUpdate; }
     void switchRenderMethod() { renderer.toggleFillLine(); }
+    void toggleGpuCulling() { renderer.toggleGpuCulling(); }
+    void toggleCullVerification() { renderer.toggleCullVerification(); }
+    void toggleOcclusionCulling() { renderer.toggleOcclusionCulling(); softwareOcclusion = !softwareOcclusion; }
+    void setOcclusionDepth(GLuint depthTexture, int w, int h) { renderer.setOcclusionDepth(depthTexture, w, h); }
+    ChunkCullStats getCullStats() const { return renderer.getCullStats(); }
+    bool usesGpuCulling() const { return renderer.usesGpuCulling(); }
+    SoftwareCullStats getSoftwareCullStats() const { return occlusionCuller.getStats(); }
+    bool usesSoftwareOcclusion() const { return softwareOcclusion; }
+    void toggleConnectivityCulling() { connectivityCulling = !connectivityCulling; }
+    bool usesConnectivityCulling() const { return connectivityCulling; }
+    VisibilityGraphStats getVisibilityGraphStats() const { return visibilityGraph.getStats(); }
+    ChunkQuadtreeStats getQuadtreeStats() const { return chunkQuadtree.getStats(); }
+    StreamingStats getStreamingStats() const { return streamer.getStats(); }
+    ChunkDirectoryStats getDirectoryStats() const { return chunks.getStats(); }
+    RetentionStats getRetentionStats() const { return retention.getStats(); }
+    ChunkReclaimerStats getReclaimerStats() const { return reclaimer.getStats(); }
+    BringUpStats getBringUpStats() const;
+    const LodSelector& getLodSelector() const { return chunkLoader.getLodSelector(); }
+    size_t getSkippedCullUpdates() const { return skippedCullUpdates; }
 
     std::shared_ptr<const std::vector<BlockID>> tryGetChunkSnapshot(ChunkUtils::ChunkCoordPair key);
 
 private:
-    void genChunkMesh(ChunkUtils::ChunkCoordPair key);
-
-    void loadChunksAsync(const std::vector<std::pair<int, int>>& loadChunks);
-    void unloadChunks(const std::vector<std::pair<int, int>>& loadChunks, bool all);
-
-    int calculateLevelOfDetail(ChunkUtils::ChunkCoordPair ccp);
+    // Block edits update the connectivity of the edited section themselves and pass false
+    void genChunkMesh(ChunkUtils::ChunkCoordPair key, bool rebuildConnectivity = true);
+
+    // Streaming thread
+    void runStreamTask(const ChunkUtils::ChunkCoordPair& key, StreamTask task);
+    std::unique_ptr<Chunk> generateChunk(const ChunkUtils::ChunkCoordPair& key, int lod);
+    std::unique_ptr<Chunk> restoreChunk(const ChunkUtils::ChunkCoordPair& key, const RetainedChunk& retained);
+    // Compresses a leaving chunk into the retention cache, adding the buckets that should be freed to releasedMeshes
+    void retainChunk(const ChunkUtils::ChunkCoordPair& key, std::vector<ChunkUtils::ChunkCoordPair>& releasedMeshes);
+    // Occluder, cull heights, connectivity and flatness, everything derived from the voxels besides the mesh
+    void updateChunkShape(const ChunkUtils::ChunkCoordPair& key, const std::vector<BlockID>& blocks, int lod, bool rebuildConnectivity);
+    void streamChunk(const ChunkUtils::ChunkCoordPair& key);
+    void relodChunk(const ChunkUtils::ChunkCoordPair& key);
+    void meshWhenNeighboursReady(const ChunkUtils::ChunkCoordPair& key);
+    void unloadChunks(bool all, const std::vector<ChunkUtils::ChunkCoordPair>& leaving);
+    static std::array<ChunkUtils::ChunkCoordPair, 4> neighboursOf(const ChunkUtils::ChunkCoordPair& key);
+    // -1 for a neighbour that isn't loaded
+    std::array<int, 4> neighbourLodsOf(const ChunkUtils::ChunkCoordPair& key) const;
+    // Main thread, at startup and whenever the world is regenerated
+    void startBringUp();
+    // After each task: moves the bring-up on once the scheduler runs dry
+    void advanceBringUp();
+
+    glm::vec2 viewForward() const;
+    void trackCameraMotion();
+    // Chunks the camera will cover over the prefetch window at its current horizontal velocity
+    glm::vec2 travelLead() const;
+
+    int calculateLevelOfDetail(ChunkUtils::ChunkCoordPair ccp, int currentLod = -1);
 
     VertexPool* vertexPool;
     TerrainRenderer renderer;
     ChunkLoader chunkLoader;
     ProcGen* proceduralGenerator;
 
-    std::unordered_set<ChunkUtils::ChunkCoordPair, ChunkUtils::PairHash> chunkKeys;
-    std::vector<ChunkUtils::ChunkCoordPair> unmeshedKeysOrder;
-    std::unordered_set<ChunkUtils::ChunkCoordPair, ChunkUtils::PairHash> unmeshedKeysSet;
-
-    inline void insertUnmeshed(const ChunkUtils::ChunkCoordPair& key) {
-        if (unmeshedKeysSet.insert(key).second) {
-            unmeshedKeysOrder.push_back(key);
-        }
-    }
+    // Streaming thread only, chunks whose mesh waits for a wanted neighbour to be generated
+    std::unordered_set<ChunkUtils::ChunkCoordPair, ChunkUtils::PairHash> deferredMeshes;
+    // Streaming thread only, whether each chunk's surface measured flat when it was first meshed
+    std::unordered_map<ChunkUtils::ChunkCoordPair, bool, ChunkUtils::PairHash> flatChunks;
+    // Streaming thread only, chunks restored with their bucket still in the pool and the neighbour levels it was
+    // meshed against. The first mesh request reuses the bucket if those still hold
+    std::unordered_map<ChunkUtils::ChunkCoordPair, std::array<int, 4>, ChunkUtils::PairHash> retainedMeshes;
+    ChunkRetentionCache retention;
+
+    // Progressive bring-up: the whole radius first at BRING_UP_LOD or coarser, then every chunk refined nearest first
+    std::atomic<BringUpPhase> bringUpPhase;
+    mutable std::mutex bringUpMtx;
+    std::chrono::steady_clock::time_point bringUpStart;
+    double horizonSeconds;
+    double fullDetailSeconds;
+    static constexpr int BRING_UP_LOD = 4;
 
     std::vector<ChunkUtils::ChunkCoordPair> currentRenderChunks;
+    // Everything the visible list depends on, update() skips culling while none of it changes
+    struct CullInputs {
+        uint64_t cameraVersion;                         // CPU culling only, the GPU pass does its own frustum test
+        uint64_t heightRevision;
+        int sectionX, sectionY, sectionZ;               // GPU culling, where the connectivity walk starts
+        uint64_t regionRevision;
+        uint64_t graphRevision;
+        int renderRadius;
+        bool gpuCulling, connectivityCulling, softwareOcclusion;
+        bool operator==(const CullInputs&) const = default;
+    };
+    CullInputs lastCullInputs;
+    size_t skippedCullUpdates;
+    ChunkQuadtree chunkQuadtree;
+    // Trims the CPU visible list when the GPU cull pass is off
+    SoftwareOcclusionCuller occlusionCuller;
+    bool softwareOcclusion;
+    VisibilityGraph visibilityGraph;
+    bool connectivityCulling;
 
     Camera* camera;
 
     // MULTITHREAD
-    std::future<void> loadFuture;
-    std::shared_mutex worldMapMtx;
     std::mutex renderBuffersMtx;
     std::atomic<bool> updatedRenderChunks;
-    std::atomic<bool> stopAsync;
 
     bool readyForPlayerUpdate;
     double lastFrustumCheck;
     int renderRadius;
 
-    std::unordered_map<ChunkUtils::ChunkCoordPair, std::unique_ptr<Chunk>, ChunkUtils::PairHash> worldMap;
+    // Declared ahead of the directory so it outlives every chunk the directory hands it
+    ChunkReclaimer reclaimer;
+    // Written only by the streaming thread, read lock-free from anywhere
+    ChunkDirectory chunks;
+
+    glm::vec2 streamForward;
+    glm::vec2 streamLead;
+    glm::vec2 cameraVelocity;       // blocks per second in xz
+    glm::vec3 lastMotionPos;
+    double lastMotionTime;
+
+    // Declared last so it is destroyed, and its thread joined, before anything the thread touches
+    StreamingScheduler streamer;
 };
\ No newline at end of file
@@ -0,0 +1,129 @@
+#shader compute
+#version 460 core
+
+layout(local_size_x = 64) in;
+
+struct DrawCommand {
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+struct ChunkBounds {
+	vec4 minCorner;
+	vec4 maxCorner;
+};
+
+// Per slot: 0 outside the frustum, 1 visible, 2 occluded
+const uint OUTSIDE = 0u;
+const uint VISIBLE = 1u;
+const uint OCCLUDED = 2u;
+
+layout(std430, binding = 0) readonly buffer SlotCommands { DrawCommand slotCommands[]; };
+layout(std430, binding = 1) readonly buffer SlotBounds { ChunkBounds slotBounds[]; };
+layout(std430, binding = 2) writeonly buffer DrawCommands { DrawCommand drawCommands[]; };
+layout(std430, binding = 3) buffer CullCounters {
+	uint drawCounts[2];		// phase 1 and phase 2 draw lists, read by glMultiDrawElementsIndirectCount
+	uint frustumPassed;
+	uint occluded;
+	uint occludedTriangles;
+};
+layout(std430, binding = 4) buffer SlotVisibility { uint slotVisibility[]; };
+
+uniform uint slotCount;
+uniform uint drawCapacity;		// phase 2 commands start at this index
+uniform uint cullPhase;
+uniform bool useOcclusion;
+uniform vec4 frustumPlanes[6];
+uniform mat4 viewProjection;
+uniform sampler2D hiZ;
+
+bool insideFrustum(vec3 lo, vec3 hi) {
+	for (int i = 0; i < 6; ++i) {
+		vec4 plane = frustumPlanes[i];
+		// Corner furthest along the plane normal, if even that one is behind the plane so is the whole box
+		vec3 corner = mix(lo, hi, greaterThanEqual(plane.xyz, vec3(0.0)));
+		if (dot(plane.xyz, corner) + plane.w < 0.0) return false;
+	}
+	return true;
+}
+
+bool occludedByHiZ(vec3 lo, vec3 hi) {
+	vec3 ndcMin = vec3(1.0);
+	vec3 ndcMax = vec3(-1.0);
+	for (int i = 0; i < 8; ++i) {
+		vec3 corner = vec3((i & 1) != 0 ? hi.x : lo.x, (i & 2) != 0 ? hi.y : lo.y, (i & 4) != 0 ? hi.z : lo.z);
+		vec4 clip = viewProjection * vec4(corner, 1.0);
+		// Crosses the near plane, its screen rect is unbounded so treat it as visible
+		if (clip.z < -clip.w) return false;
+		vec3 ndc = clip.xyz / clip.w;
+		ndcMin = min(ndcMin, ndc);
+		ndcMax = max(ndcMax, ndc);
+	}
+
+	vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5, 0.0, 1.0);
+	vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5, 0.0, 1.0);
+	float nearestDepth = ndcMin.z * 0.5 + 0.5;
+
+	// Pick the level where the rect spans at most 2x2 texels, each holding the farthest depth beneath it
+	vec2 rect = (uvMax - uvMin) * vec2(textureSize(hiZ, 0));
+	int lod = clamp(int(ceil(log2(max(max(rect.x, rect.y), 1.0)))), 0, textureQueryLevels(hiZ) - 1);
+	ivec2 size = textureSize(hiZ, lod);
+	ivec2 texMin = clamp(ivec2(uvMin * vec2(size)), ivec2(0), size - 1);
+	ivec2 texMax = clamp(ivec2(uvMax * vec2(size)), ivec2(0), size - 1);
+
+	float farthest = 0.0;
+	for (int y = texMin.y; y <= texMax.y; ++y) {
+		for (int x = texMin.x; x <= texMax.x; ++x) {
+			farthest = max(farthest, texelFetch(hiZ, ivec2(x, y), lod).r);
+		}
+	}
+	return nearestDepth > farthest;
+}
+
+void emit(DrawCommand cmd, uint slot, uint list) {
+	// baseInstance isn't read by Block.shader, it carries the slot so draw lists can be checked on the CPU
+	cmd.instanceCount = 1u;
+	cmd.baseInstance = slot;
+	drawCommands[list * drawCapacity + atomicAdd(drawCounts[list], 1u)] = cmd;
+}
+
+void main() {
+	uint slot = gl_GlobalInvocationID.x;
+	if (slot >= slotCount) return;
+
+	DrawCommand cmd = slotCommands[slot];
+	ChunkBounds bounds = slotBounds[slot];
+	// An instance count of zero means the CPU visible list left the chunk out, e.g. the connectivity walk never reached it
+	bool inFrustum = cmd.count != 0u && cmd.instanceCount != 0u && insideFrustum(bounds.minCorner.xyz, bounds.maxCorner.xyz);
+
+	if (cullPhase == 0u) {
+		// Phase 1 draws whatever was visible last frame, its depth becomes the occluders for phase 2
+		if (!useOcclusion) {
+			slotVisibility[slot] = inFrustum ? VISIBLE : OUTSIDE;
+			if (inFrustum) atomicAdd(frustumPassed, 1u);
+		}
+		if (inFrustum && (!useOcclusion || slotVisibility[slot] == VISIBLE)) emit(cmd, slot, 0u);
+		return;
+	}
+
+	// Phase 2 tests everything against this frame's Hi-Z and draws the newly disoccluded slots
+	uint previous = slotVisibility[slot];
+	if (!inFrustum) {
+		slotVisibility[slot] = OUTSIDE;
+		return;
+	}
+	atomicAdd(frustumPassed, 1u);
+
+	if (occludedByHiZ(bounds.minCorner.xyz, bounds.maxCorner.xyz)) {
+		slotVisibility[slot] = OCCLUDED;
+		atomicAdd(occluded, 1u);
+		if (previous != VISIBLE) atomicAdd(occludedTriangles, cmd.count / 3u);
+		return;
+	}
+
+	slotVisibility[slot] = VISIBLE;
+	if (previous != VISIBLE) emit(cmd, slot, 1u);
+}
\ No newline at end of file
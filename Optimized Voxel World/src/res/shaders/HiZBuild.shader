@@ -0,0 +1,29 @@
+#shader compute
+#version 460 core
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(r32f, binding = 0) uniform writeonly image2D dstLevel;
+layout(r32f, binding = 1) uniform readonly image2D srcLevel;
+uniform sampler2D depthTexture;
+uniform bool fromDepth;
+uniform ivec2 srcSize;
+
+void main() {
+	ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 dstSize = imageSize(dstLevel);
+	if (any(greaterThanEqual(dst, dstSize))) return;
+
+	// Every source texel this one overlaps, the ratio isn't a whole number when reducing the depth buffer
+	ivec2 first = (dst * srcSize) / dstSize;
+	ivec2 last = min(((dst + 1) * srcSize + dstSize - 1) / dstSize, srcSize) - 1;
+
+	float farthest = 0.0;
+	for (int y = first.y; y <= last.y; ++y) {
+		for (int x = first.x; x <= last.x; ++x) {
+			float depth = fromDepth ? texelFetch(depthTexture, ivec2(x, y), 0).r : imageLoad(srcLevel, ivec2(x, y)).r;
+			farthest = max(farthest, depth);
+		}
+	}
+	imageStore(dstLevel, dst, vec4(farthest));
+}
\ No newline at end of file